@@ -3,7 +3,9 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
 
 /* A block device. */
 struct block
@@ -17,10 +19,12 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct iostat stats;                /* I/O statistics. */
   };
 
+/* If true, print detailed statistics. */
+bool block_detailed_stats;
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -113,6 +117,86 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Returns the processor's time-stamp counter. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Records the start of a request to BLOCK and returns its start
+   time, for passing to end_request(). */
+static uint64_t
+begin_request (struct block *block)
+{
+  struct iostat *st = &block->stats;
+  enum intr_level old_level;
+
+  thread_current ()->io_depth++;
+
+  old_level = intr_disable ();
+
+  st->depth++;
+  if (st->depth > st->max_depth)
+    st->max_depth = st->depth;
+  st->depth_sum += st->depth;
+  intr_set_level (old_level);
+
+  return read_tsc ();
+}
+
+/* Records the completion of a request to BLOCK, started at
+   START, that read (if WRITE is false) or wrote CNT sectors.
+   Charges it to the running thread unless it was made on behalf
+   of another request, as a partition passes its requests on to
+   the disk that holds it, so that each is charged only once. */
+static void
+end_request (struct block *block, uint64_t start, bool write,
+             block_sector_t cnt)
+{
+  struct iostat *st = &block->stats;
+  struct thread *t = thread_current ();
+  unsigned long long bytes = (unsigned long long) cnt * BLOCK_SECTOR_SIZE;
+  uint64_t cycles = read_tsc () - start;
+  enum intr_level old_level;
+  int bucket;
+
+  for (bucket = 0; bucket < IOSTAT_HIST_CNT - 1 && cycles > 1; bucket++)
+    cycles >>= 1;
+
+  old_level = intr_disable ();
+  st->depth--;
+  if (write)
+    {
+      st->write_bytes += bytes;
+      st->write_reqs++;
+      st->write_latency[bucket]++;
+    }
+  else
+    {
+      st->read_bytes += bytes;
+      st->read_reqs++;
+      st->read_latency[bucket]++;
+    }
+  intr_set_level (old_level);
+
+  if (--t->io_depth == 0)
+    {
+      if (write)
+        {
+          t->io_write_bytes += bytes;
+          t->io_write_reqs++;
+        }
+      else
+        {
+          t->io_read_bytes += bytes;
+          t->io_read_reqs++;
+        }
+    }
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +204,12 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
+  start = begin_request (block);
   block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  end_request (block, start, false, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +220,95 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
+  start = begin_request (block);
   block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  end_request (block, start, true, 1);
+}
+
+/* Verifies that the CNT sectors starting at SECTOR lie within
+   BLOCK and that the IOV_CNT buffers in IOV hold exactly that
+   many sectors.  Panics if not. */
+static void
+check_multi (struct block *block, block_sector_t sector, block_sector_t cnt,
+             const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t total = 0;
+  size_t i;
+
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  for (i = 0; i < iov_cnt; i++)
+    {
+      ASSERT (iov[i].size % BLOCK_SECTOR_SIZE == 0);
+      total += iov[i].size;
+    }
+  ASSERT (total == (size_t) cnt * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into the
+   IOV_CNT buffers in IOV, in order.  The buffers' sizes must be
+   multiples of BLOCK_SECTOR_SIZE that add up to CNT sectors.
+   Drivers that support it transfer many sectors per command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector,
+                  block_sector_t cnt,
+                  const struct block_iovec *iov, size_t iov_cnt)
+{
+  uint64_t start;
+  size_t i;
+
+  check_multi (block, sector, cnt, iov, iov_cnt);
+  start = begin_request (block);
+  if (block->ops->read_multi != NULL)
+    block->ops->read_multi (block->aux, sector, cnt, iov, iov_cnt);
+  else
+    for (i = 0; i < iov_cnt; i++)
+      {
+        size_t ofs;
+
+        for (ofs = 0; ofs < iov[i].size; ofs += BLOCK_SECTOR_SIZE)
+          block->ops->read (block->aux, sector++,
+                            (uint8_t *) iov[i].base + ofs);
+      }
+  end_request (block, start, false, cnt);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from the
+   IOV_CNT buffers in IOV, in order, as block_read_multi().
+   Returns after the block device has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector,
+                   block_sector_t cnt,
+                   const struct block_iovec *iov, size_t iov_cnt)
+{
+  uint64_t start;
+  size_t i;
+
+  check_multi (block, sector, cnt, iov, iov_cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  start = begin_request (block);
+  if (block->ops->write_multi != NULL)
+    block->ops->write_multi (block->aux, sector, cnt, iov, iov_cnt);
+  else
+    for (i = 0; i < iov_cnt; i++)
+      {
+        size_t ofs;
+
+        for (ofs = 0; ofs < iov[i].size; ofs += BLOCK_SECTOR_SIZE)
+          block->ops->write (block->aux, sector++,
+                             (const uint8_t *) iov[i].base + ofs);
+      }
+  end_request (block, start, true, cnt);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +332,38 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints latency histogram HIST, labeled with WHAT, skipping
+   empty buckets. */
+static void
+print_histogram (const char *what, const unsigned long long *hist)
+{
+  int i;
+
+  printf ("  %s latency (TSC cycles, log2):", what);
+  for (i = 0; i < IOSTAT_HIST_CNT; i++)
+    if (hist[i] != 0)
+      printf (" %s2^%d: %llu", i == IOSTAT_HIST_CNT - 1 ? ">=" : "",
+              i, hist[i]);
+  printf ("\n");
+}
+
+/* Prints detailed statistics for BLOCK. */
+static void
+print_detailed_stats (struct block *block)
+{
+  const struct iostat *st = &block->stats;
+  unsigned long long reqs = st->read_reqs + st->write_reqs;
+  unsigned long long avg = reqs != 0 ? st->depth_sum * 100 / reqs : 0;
+
+  printf ("  %llu bytes read in %llu requests, "
+          "%llu bytes written in %llu requests\n",
+          st->read_bytes, st->read_reqs, st->write_bytes, st->write_reqs);
+  printf ("  queue depth: average %llu.%02llu, maximum %u\n",
+          avg / 100, avg % 100, st->max_depth);
+  print_histogram ("read", st->read_latency);
+  print_histogram ("write", st->write_latency);
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -173,11 +377,45 @@ block_print_stats (void)
         {
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->stats.read_bytes / BLOCK_SECTOR_SIZE,
+                  block->stats.write_bytes / BLOCK_SECTOR_SIZE);
+          if (block_detailed_stats)
+            print_detailed_stats (block);
         }
     }
 }
 
+/* Copies the statistics for the block device named NAME into
+   *STATS.  Returns true if successful, false if there is no such
+   device. */
+bool
+block_get_stats (const char *name, struct iostat *stats)
+{
+  struct block *block = block_get_by_name (name);
+  enum intr_level old_level;
+
+  if (block == NULL)
+    return false;
+  old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Fills in the byte and request counts in *STATS with the block
+   I/O done by the running thread, and zeros the rest. */
+void
+block_get_thread_stats (struct iostat *stats)
+{
+  struct thread *t = thread_current ();
+
+  memset (stats, 0, sizeof *stats);
+  stats->read_bytes = t->io_read_bytes;
+  stats->write_bytes = t->io_write_bytes;
+  stats->read_reqs = t->io_read_reqs;
+  stats->write_reqs = t->io_write_reqs;
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -198,8 +436,7 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
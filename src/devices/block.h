@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <iostat.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -22,6 +24,14 @@ typedef uint32_t block_sector_t;
 
 struct block;
 
+/* One piece of a scatter-gather buffer for a multi-sector
+   transfer.  SIZE must be a multiple of BLOCK_SECTOR_SIZE. */
+struct block_iovec
+  {
+    void *base;                  /* Start of buffer. */
+    size_t size;                 /* Size of buffer in bytes. */
+  };
+
 /* Type of a block device. */
 enum block_type
   {
@@ -53,18 +63,39 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, block_sector_t cnt,
+                       const struct block_iovec *, size_t iov_cnt);
+void block_write_multi (struct block *, block_sector_t, block_sector_t cnt,
+                        const struct block_iovec *, size_t iov_cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
 void block_print_stats (void);
+bool block_get_stats (const char *name, struct iostat *);
+void block_get_thread_stats (struct iostat *);
+
+/* If false (default), print only sector counts at shutdown.
+   If true, also print request counts, queue depths, and latency
+   histograms, and each process's I/O when it exits.
+   Controlled by kernel command-line option "-stats". */
+extern bool block_detailed_stats;
 
 /* Lower-level interface to block device drivers. */
 
+/* Operations on a block device.  READ_MULTI and WRITE_MULTI
+   transfer CNT consecutive sectors to or from the buffers in IOV,
+   whose sizes add up to CNT * BLOCK_SECTOR_SIZE.  They may be
+   null, in which case the block layer transfers one sector at a
+   time with READ and WRITE. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multi) (void *aux, block_sector_t, block_sector_t cnt,
+                        const struct block_iovec *, size_t iov_cnt);
+    void (*write_multi) (void *aux, block_sector_t, block_sector_t cnt,
+                         const struct block_iovec *, size_t iov_cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -1,14 +1,18 @@
 #include "devices/ide.h"
 #include <ctype.h>
 #include <debug.h>
+#include <list.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -30,10 +34,17 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, relative to the base I/O port
+   that the controller's PCI configuration assigns each channel. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRDT address. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -43,12 +54,67 @@
 #define DEV_LBA 0x40            /* Linear based addressing. */
 #define DEV_DEV 0x10            /* Select device: 0=master, 1=slave. */
 
+/* Bus master command register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_READ 0x08            /* Transfer from disk to memory. */
+
+/* Bus master status register bits.  Writing 1 clears them. */
+#define BMS_ERROR 0x02          /* Transfer failed. */
+#define BMS_INTR 0x04           /* Disk interrupted. */
+
 /* Commands.
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum sectors transferred by one READ or WRITE SECTOR
+   command.  A sector count register value of 0 means 256. */
+#define MAX_CMD_SECTORS 256
+
+/* Physical region descriptor, telling a bus master controller
+   where in physical memory to transfer data.  A descriptor may
+   not cross a 64 kB boundary, and a SIZE of 0 means 64 kB. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Number of descriptors in a channel's table. */
+#define PRD_CNT 128
+
+/* If true, use bus master DMA, if available, instead of PIO.
+   Controlled by kernel command-line option "-dma". */
+bool ide_dma;
+
+/* A request to transfer CNT sectors starting at SEC_NO between
+   DISK and the buffers at IOV and OFS.  The submitter sleeps on
+   DONE, which is up'd once the whole transfer is complete.
+
+   Requests are queued on their disk's channel, which the
+   channel's dispatcher thread and its interrupt handler share,
+   so the queue and commands are protected by disabling
+   interrupts. */
+struct ide_request
+  {
+    struct list_elem elem;      /* Element in queue or batch. */
+    struct ata_disk *disk;      /* Disk to transfer to or from. */
+    bool write;                 /* True to write, false to read. */
+    block_sector_t sec_no;      /* Next sector to transfer. */
+    block_sector_t cnt;         /* Number of sectors left. */
+    const struct block_iovec *iov;      /* Current buffer. */
+    size_t ofs;                 /* Offset of next sector in *IOV. */
+    block_sector_t cmd_cnt;     /* Sectors in command in progress. */
+    block_sector_t cmd_done;    /* Of those, sectors transferred. */
+    struct semaphore done;      /* Up'd on completion. */
+  };
 
 /* An ATA device. */
 struct ata_disk
@@ -67,12 +133,29 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    /* Request queue, sorted by position (see request_pos()), and
+       the requests in the command in progress, in disk order.
+       The command in progress covers the whole of each request in
+       BATCH except possibly the first. */
+    struct list queue;          /* Pending requests. */
+    struct list batch;          /* Requests in progress. */
+    uint64_t head_pos;          /* Position just past the last command. */
+
+    /* Dispatcher thread, which starts commands and does whatever
+       else must wait for the disk. */
+    struct semaphore dispatch;  /* Up'd when there may be work. */
+    bool write_stalled;         /* PIO write waiting for the disk? */
+
+    /* Bus master DMA.  The table must not cross a 64 kB
+       boundary, which its alignment guarantees. */
+    uint16_t bm_base;           /* Bus master base port, 0 for PIO only. */
+    struct prd prdt[PRD_CNT] __attribute__ ((aligned (PRD_CNT * 8)));
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -81,21 +164,25 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static void init_dma (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static void select_sectors (struct ata_disk *, block_sector_t,
+                            block_sector_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool spin_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static thread_func dispatcher NO_RETURN;
 
 /* Initialize the disk subsystem and detect disks. */
 void
@@ -123,9 +210,14 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      list_init (&c->queue);
+      list_init (&c->batch);
+      c->head_pos = 0;
+      sema_init (&c->dispatch, 0);
+      c->write_stalled = false;
+      c->bm_base = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -144,6 +236,10 @@ ide_init (void)
       /* Reset hardware. */
       reset_channel (c);
 
+      /* Start dispatching requests, which partition_scan() below
+         already needs. */
+      thread_create (c->name, PRI_MAX, dispatcher, c);
+
       /* Distinguish ATA hard disks from other devices. */
       if (check_device_type (&c->devices[0]))
         check_device_type (&c->devices[1]);
@@ -153,6 +249,43 @@ ide_init (void)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
     }
+
+  if (ide_dma)
+    init_dma ();
+}
+
+/* Finds the PCI IDE controller and, if it supports bus master
+   DMA, enables DMA on both channels.  Otherwise, leaves the
+   channels using PIO. */
+static void
+init_dma (void)
+{
+  struct pci_dev pci;
+  uint32_t bar;
+  size_t chan_no;
+
+  /* Class 1 (mass storage), subclass 1 (IDE).  Bit 7 of the
+     programming interface byte says whether the controller can
+     be a bus master, and BAR 4 holds its I/O ports. */
+  if (!pci_find_class (0x01, 0x01, &pci)
+      || !(pci_read_config (&pci, PCI_REG_CLASS) & 0x8000))
+    {
+      printf ("ide: no bus master IDE controller, using PIO\n");
+      return;
+    }
+  bar = pci_read_config (&pci, PCI_REG_BAR0 + 4 * 4);
+  if (!(bar & PCI_BAR_IO) || (bar & ~3u) == 0)
+    {
+      printf ("ide: bus master registers not in I/O space, using PIO\n");
+      return;
+    }
+
+  pci_write_config (&pci, PCI_REG_COMMAND,
+                    (pci_read_config (&pci, PCI_REG_COMMAND)
+                     | PCI_CMD_IO | PCI_CMD_MASTER));
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    channels[chan_no].bm_base = (bar & ~3u) + 8 * chan_no;
+  printf ("ide: using bus master DMA at port %#x\n", bar & ~3u);
 }
 
 /* Disk detection and identification. */
@@ -272,7 +405,7 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -337,63 +470,442 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Returns the next sector-sized piece of the scatter-gather
+   buffer at *IOV, advancing *IOV and *OFS past it. */
+static uint8_t *
+next_sector (const struct block_iovec **iov, size_t *ofs)
+{
+  uint8_t *sector;
+
+  while (*ofs >= (*iov)->size)
+    {
+      (*iov)++;
+      *ofs = 0;
+    }
+  sector = (uint8_t *) (*iov)->base + *ofs;
+  *ofs += BLOCK_SECTOR_SIZE;
+  return sector;
+}
+
+/* Appends the sector-sized kernel BUFFER to the CNT descriptors
+   in PRDT, extending the last descriptor if BUFFER follows it in
+   physical memory, and returns the new number of descriptors.
+   Adds at most two descriptors. */
+static size_t
+prd_add (struct prd *prdt, size_t cnt, const void *buffer)
+{
+  uint32_t addr = vtop (buffer);
+  uint32_t left = BLOCK_SECTOR_SIZE;
+
+  while (left > 0)
+    {
+      /* Don't cross a 64 kB boundary. */
+      uint32_t chunk = 0x10000 - (addr & 0xffff);
+      if (chunk > left)
+        chunk = left;
+
+      if (cnt > 0 && (addr & 0xffff) != 0
+          && prdt[cnt - 1].addr + prdt[cnt - 1].size == addr)
+        prdt[cnt - 1].size += chunk;
+      else
+        {
+          prdt[cnt].addr = addr;
+          prdt[cnt].size = chunk;
+          prdt[cnt].flags = 0;
+          cnt++;
+        }
+      addr += chunk;
+      left -= chunk;
+    }
+  return cnt;
+}
+
+/* Request queue.
+
+   Submitters add requests to their channel's queue and sleep
+   until they are complete.  Whenever the channel is idle, the
+   request to go next is chosen by the C-LOOK elevator policy:
+   the pending request at the lowest position at or beyond the
+   end of the previous command, or, if there is none, the one at
+   the lowest position overall.  Pending requests that continue
+   it on disk, in the same direction, are merged into the same
+   command.
+
+   The interrupt handler only transfers PIO data that the disk
+   has ready and completes commands.  Anything that has to wait
+   for the disk, which is starting a command and sending a PIO
+   write sector that the disk was not yet ready for, is left to
+   the channel's dispatcher thread, so that device polling never
+   runs with interrupts off. */
+
+static void start_command (struct channel *);
+
+/* Returns request R's position in its channel's queue: its disk
+   number, then its next sector. */
+static uint64_t
+request_pos (const struct ide_request *r)
+{
+  return ((uint64_t) r->disk->dev_no << 32) | r->sec_no;
+}
+
+/* Returns true if request A is at a lower position than B. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct ide_request *a = list_entry (a_, struct ide_request, elem);
+  const struct ide_request *b = list_entry (b_, struct ide_request, elem);
+  return request_pos (a) < request_pos (b);
+}
+
+/* Queues request R for transfer, starting it at once if its
+   channel is idle, and waits for it to complete. */
+static void
+submit_request (struct ide_request *r)
+{
+  struct channel *c = r->disk->channel;
+  enum intr_level old_level;
+
+  ASSERT (r->cnt > 0);
+
+  sema_init (&r->done, 0);
+  old_level = intr_disable ();
+  list_insert_ordered (&c->queue, &r->elem, request_less, NULL);
+  if (list_empty (&c->batch))
+    sema_up (&c->dispatch);
+  intr_set_level (old_level);
+
+  sema_down (&r->done);
+}
+
+/* Adds up to CNT sectors of request R to the command being built
+   for channel C, limited by the room left in C's descriptor
+   table if PRD_CNT is nonnull, in which case the sectors are
+   added to the table and *PRD_CNT is updated.  Returns the number
+   of sectors added. */
+static block_sector_t
+add_to_command (struct channel *c, struct ide_request *r, block_sector_t cnt,
+                size_t *prd_cnt)
+{
+  block_sector_t n;
+
+  if (prd_cnt == NULL)
+    n = cnt;
+  else
+    for (n = 0; n < cnt && *prd_cnt + 2 <= PRD_CNT; n++)
+      *prd_cnt = prd_add (c->prdt, *prd_cnt, next_sector (&r->iov, &r->ofs));
+  r->cmd_cnt = n;
+  r->cmd_done = 0;
+  list_push_back (&c->batch, &r->elem);
+  return n;
+}
+
+/* Picks the next request in channel C's queue, merges in any
+   that follow it on disk, and starts a command for them.  Does
+   nothing if a command is in progress or the queue is empty.
+   Called by C's dispatcher thread, with interrupts on. */
+static void
+start_command (struct channel *c)
+{
+  struct ide_request *first, *r;
+  struct list_elem *e;
+  size_t prd_cnt = 0;
+  size_t *prd = c->bm_base != 0 ? &prd_cnt : NULL;
+  block_sector_t cnt;
+  uint8_t command;
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (!list_empty (&c->batch) || list_empty (&c->queue))
+    {
+      intr_set_level (old_level);
+      return;
+    }
+
+  /* C-LOOK: the first request at or past the head, else the
+     first overall. */
+  for (e = list_begin (&c->queue); e != list_end (&c->queue);
+       e = list_next (e))
+    if (request_pos (list_entry (e, struct ide_request, elem)) >= c->head_pos)
+      break;
+  if (e == list_end (&c->queue))
+    e = list_begin (&c->queue);
+  first = list_entry (e, struct ide_request, elem);
+  e = list_remove (e);
+  cnt = add_to_command (c, first,
+                        first->cnt < MAX_CMD_SECTORS ? first->cnt
+                        : MAX_CMD_SECTORS, prd);
+
+  /* Merge in whole requests that continue the first on disk. */
+  if (cnt == first->cnt)
+    while (e != list_end (&c->queue))
+      {
+        r = list_entry (e, struct ide_request, elem);
+        if (r->disk != first->disk || r->write != first->write
+            || r->sec_no != first->sec_no + cnt
+            || cnt + r->cnt > MAX_CMD_SECTORS
+            || (prd != NULL && prd_cnt + 2 * r->cnt > PRD_CNT))
+          break;
+        e = list_remove (e);
+        cnt += add_to_command (c, r, r->cnt, prd);
+      }
+  c->head_pos = request_pos (first) + cnt;
+  intr_set_level (old_level);
+
+  /* Issue the command.  The batch is now ours until the disk
+     interrupts, which it cannot do before the command is issued,
+     so waiting for the disk here needs interrupts off only
+     around the final steps. */
+  select_sectors (first->disk, first->sec_no, cnt);
+  if (prd != NULL)
+    {
+      uint8_t direction = first->write ? 0 : BM_READ;
+
+      c->prdt[prd_cnt - 1].flags = PRD_EOT;
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      outb (reg_bm_command (c), direction);
+      outb (reg_bm_status (c), BMS_ERROR | BMS_INTR);
+      old_level = intr_disable ();
+      issue_command (c, first->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), direction | BM_START);
+      intr_set_level (old_level);
+    }
+  else
+    {
+      command = first->write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY;
+      issue_command (c, command);
+
+      /* For a PIO write, the disk asks for the first sector
+         right away, and interrupts after each one. */
+      if (first->write)
+        {
+          if (!spin_while_busy (first->disk))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   first->disk->name, first->sec_no);
+          old_level = intr_disable ();
+          output_sector (c, next_sector (&first->iov, &first->ofs));
+          first->cmd_done++;
+          intr_set_level (old_level);
+        }
+    }
+}
+
+/* Returns the request in channel C's command in progress that
+   the next PIO sector belongs to. */
+static struct ide_request *
+current_request (struct channel *c)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&c->batch); e != list_end (&c->batch);
+       e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      if (r->cmd_done < r->cmd_cnt)
+        return r;
+    }
+  return NULL;
+}
+
+/* Handles a completion interrupt for channel C's command in
+   progress: transfers the next PIO sector, if any, or completes
+   the command and starts the next one. */
+static void
+request_interrupt (struct channel *c)
+{
+  struct ide_request *first
+    = list_entry (list_front (&c->batch), struct ide_request, elem);
+  struct ide_request *r;
+  uint8_t status = inb (reg_status (c));        /* Acknowledge. */
+
+  if (c->bm_base != 0)
+    {
+      /* DMA: the whole command is done. */
+      uint8_t bm_status;
+
+      outb (reg_bm_command (c), first->write ? 0 : BM_READ);
+      bm_status = inb (reg_bm_status (c));
+      outb (reg_bm_status (c), BMS_ERROR | BMS_INTR);
+      if ((bm_status & BMS_ERROR) || (status & STA_ERR))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, first->disk->name,
+               first->write ? "write" : "read", first->sec_no);
+    }
+  else
+    {
+      /* PIO: one sector is done. */
+      if (status & STA_ERR)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, first->disk->name,
+               first->write ? "write" : "read", first->sec_no);
+      if (!first->write)
+        {
+          r = current_request (c);
+          input_sector (c, next_sector (&r->iov, &r->ofs));
+          r->cmd_done++;
+        }
+      r = current_request (c);
+      if (r != NULL)
+        {
+          /* The disk normally interrupts a PIO write when it is
+             ready for the next sector.  If it is not, leave the
+             waiting to the dispatcher thread. */
+          if (first->write)
+            {
+              if ((status & (STA_BSY | STA_DRQ)) == STA_DRQ)
+                {
+                  output_sector (c, next_sector (&r->iov, &r->ofs));
+                  r->cmd_done++;
+                }
+              else
+                {
+                  c->write_stalled = true;
+                  sema_up (&c->dispatch);
+                }
+            }
+          return;
+        }
+    }
+
+  /* Complete the command.  A partly transferred request goes
+     back into the queue. */
+  c->expecting_interrupt = false;
+  while (!list_empty (&c->batch))
+    {
+      r = list_entry (list_pop_front (&c->batch), struct ide_request, elem);
+      r->sec_no += r->cmd_cnt;
+      r->cnt -= r->cmd_cnt;
+      if (r->cnt > 0)
+        list_insert_ordered (&c->queue, &r->elem, request_less, NULL);
+      else
+        sema_up (&r->done);
+    }
+  sema_up (&c->dispatch);
+}
+
+/* Sends the next sector of channel C's PIO write command, once
+   the disk is ready for it, after the interrupt handler found
+   that it was not. */
+static void
+resume_write (struct channel *c)
+{
+  struct ide_request *r = current_request (c);
+  enum intr_level old_level;
+
+  c->write_stalled = false;
+  if (!spin_while_busy (r->disk))
+    PANIC ("%s: disk write failed, sector=%"PRDSNu,
+           r->disk->name, r->sec_no + r->cmd_done);
+  old_level = intr_disable ();
+  output_sector (c, next_sector (&r->iov, &r->ofs));
+  r->cmd_done++;
+  intr_set_level (old_level);
+}
+
+/* Dispatcher thread for channel C_: starts commands as requests
+   arrive and commands complete, and resumes stalled PIO
+   writes. */
+static void
+dispatcher (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      sema_down (&c->dispatch);
+      if (c->write_stalled)
+        resume_write (c);
+      else
+        start_command (c);
+    }
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into the
+   buffers in IOV, using DMA if it is enabled and PIO otherwise.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multi (void *d, block_sector_t sec_no, block_sector_t cnt,
+                const struct block_iovec *iov, size_t iov_cnt UNUSED)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  struct ide_request r;
+
+  r.disk = d;
+  r.write = false;
+  r.sec_no = sec_no;
+  r.cnt = cnt;
+  r.iov = iov;
+  r.ofs = 0;
+  submit_request (&r);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D from the
+   buffers in IOV, using DMA if it is enabled and PIO otherwise.
+   Returns after the disk has acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multi (void *d, block_sector_t sec_no, block_sector_t cnt,
+                 const struct block_iovec *iov, size_t iov_cnt UNUSED)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  struct ide_request r;
+
+  r.disk = d;
+  r.write = true;
+  r.sec_no = sec_no;
+  r.cnt = cnt;
+  r.iov = iov;
+  r.ofs = 0;
+  submit_request (&r);
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.base = buffer;
+  iov.size = BLOCK_SECTOR_SIZE;
+  ide_read_multi (d, sec_no, 1, &iov, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.base = (void *) buffer;
+  iov.size = BLOCK_SECTOR_SIZE;
+  ide_write_multi (d, sec_no, 1, &iov, 1);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_CMD_SECTORS, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_CMD_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_CMD_SECTORS);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,12 +916,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
-  /* Interrupts must be enabled or our semaphore will never be
-     up'd by the completion handler. */
-  ASSERT (intr_get_level () == INTR_ON);
-
   c->expecting_interrupt = true;
   outb (reg_command (c), command);
 }
@@ -446,7 +954,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,6 +987,25 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Busy-waits up to 100 ms for disk D to clear BSY, and then
+   returns the status of the DRQ bit.  Unlike wait_while_busy(),
+   may be called with interrupts off. */
+static bool
+spin_while_busy (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 10000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return (status & STA_DRQ) != 0;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +1016,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,13 +1038,15 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt) 
+        if (!c->expecting_interrupt) 
+          printf ("%s: unexpected interrupt\n", c->name);
+        else if (!list_empty (&c->batch))
+          request_interrupt (c);
+        else
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
-        else
-          printf ("%s: unexpected interrupt\n", c->name);
         return;
       }
 
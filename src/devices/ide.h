@@ -1,6 +1,13 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* If false (default), transfer data to and from IDE disks with
+   PIO.  If true, use bus master DMA when the controller supports
+   it.  Controlled by kernel command-line option "-dma". */
+extern bool ide_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
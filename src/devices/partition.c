@@ -317,8 +317,30 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads CNT sectors starting at SECTOR in partition P into the
+   IOV_CNT buffers in IOV. */
+static void
+partition_read_multi (void *p_, block_sector_t sector, block_sector_t cnt,
+                      const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct partition *p = p_;
+  block_read_multi (p->block, p->start + sector, cnt, iov, iov_cnt);
+}
+
+/* Writes CNT sectors starting at SECTOR in partition P from the
+   IOV_CNT buffers in IOV. */
+static void
+partition_write_multi (void *p_, block_sector_t sector, block_sector_t cnt,
+                       const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct partition *p = p_;
+  block_write_multi (p->block, p->start + sector, cnt, iov, iov_cnt);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multi,
+    partition_write_multi
   };
@@ -0,0 +1,116 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* PCI configuration space access through configuration
+   mechanism #1: write the address of a 32-bit register to
+   PCI_CONFIG_ADDRESS, then read or write it at PCI_CONFIG_DATA.
+   See [PCI] section 3.2.2.3.2. */
+
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Selects register REG of function D for the next access to
+   PCI_CONFIG_DATA. */
+static void
+select_register (const struct pci_dev *d, uint8_t reg)
+{
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDRESS, (0x80000000 | (d->bus << 16) | (d->dev << 11)
+                             | (d->func << 8) | reg));
+}
+
+/* Returns the 32-bit configuration register REG, which must be
+   a multiple of 4, of function D. */
+uint32_t
+pci_read_config (const struct pci_dev *d, uint8_t reg)
+{
+  select_register (d, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit configuration register REG, which
+   must be a multiple of 4, of function D. */
+void
+pci_write_config (const struct pci_dev *d, uint8_t reg, uint32_t value)
+{
+  select_register (d, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Scans the PCI buses for the INDEX'th function (counting from
+   0) for which MATCH returns true when passed the function's
+   location and AUX.  If there is one, stores its location in *D
+   and returns true; otherwise, returns false. */
+static bool
+find_function (bool (*match) (const struct pci_dev *, const void *aux),
+               const void *aux, int index, struct pci_dev *d)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          d->bus = bus;
+          d->dev = dev;
+          d->func = func;
+          if ((pci_read_config (d, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is absent, so is
+                 the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if (match (d, aux) && index-- == 0)
+            return true;
+        }
+  return false;
+}
+
+/* Returns true if function D has the class and subclass codes
+   in the two bytes at AUX. */
+static bool
+match_class (const struct pci_dev *d, const void *aux)
+{
+  const uint8_t *codes = aux;
+  uint32_t class_reg = pci_read_config (d, PCI_REG_CLASS);
+  return ((class_reg >> 24) == codes[0]
+          && ((class_reg >> 16) & 0xff) == codes[1]);
+}
+
+/* Scans the PCI buses for the first function with the given
+   CLASS and SUBCLASS codes.  If one is found, stores its
+   location in *D and returns true; otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *d)
+{
+  uint8_t codes[2];
+
+  codes[0] = class;
+  codes[1] = subclass;
+  return find_function (match_class, codes, 0, d);
+}
+
+/* Returns true if function D has the vendor and device IDs in
+   the 32-bit word at AUX, in the format of PCI_REG_ID. */
+static bool
+match_id (const struct pci_dev *d, const void *aux)
+{
+  const uint32_t *id = aux;
+  return pci_read_config (d, PCI_REG_ID) == *id;
+}
+
+/* Scans the PCI buses for the INDEX'th function (counting from
+   0) with the given VENDOR and DEVICE IDs.  If there is one,
+   stores its location in *D and returns true; otherwise,
+   returns false. */
+bool
+pci_find_device (uint16_t vendor, uint16_t device, int index,
+                 struct pci_dev *d)
+{
+  uint32_t id = ((uint32_t) device << 16) | vendor;
+  return find_function (match_id, &id, index, d);
+}
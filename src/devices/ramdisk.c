@@ -0,0 +1,142 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device whose sectors are kept in memory, in pages
+   obtained from the kernel pool.  Its contents start out as all
+   zeros and are lost at shutdown.  Transfers are plain memory
+   copies that complete at once, so no locking is needed beyond
+   what callers already do to avoid concurrent access to a
+   sector. */
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;            /* Pages holding the sectors. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk of KB kilobytes, rounded up to a whole
+   number of pages, and registers it as block device "ram0".
+   Does nothing if KB is 0. */
+void
+ramdisk_init (size_t kb)
+{
+  struct ramdisk *rd;
+  size_t i;
+
+  if (kb == 0)
+    return;
+
+  rd = malloc (sizeof *rd);
+  if (rd == NULL)
+    PANIC ("ram0: out of memory");
+  rd->page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("ram0: out of memory");
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("ram0: out of memory after %zu of %zu pages",
+               i, rd->page_cnt);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  rd->page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, rd);
+}
+
+/* Returns the address of SECTOR in RD. */
+static uint8_t *
+sector_addr (const struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Copies CNT sectors starting at SECTOR in RD to or from the
+   buffers in IOV: from RD if WRITE is false, to RD if it is
+   true.  Each copy covers as many sectors as are contiguous both
+   in RD and in the current buffer. */
+static void
+ramdisk_copy (struct ramdisk *rd, block_sector_t sector, block_sector_t cnt,
+              const struct block_iovec *iov, bool write)
+{
+  size_t ofs = 0;
+
+  while (cnt > 0)
+    {
+      size_t page_left = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      size_t iov_left = (iov->size - ofs) / BLOCK_SECTOR_SIZE;
+      size_t n = page_left < iov_left ? page_left : iov_left;
+      uint8_t *buffer = (uint8_t *) iov->base + ofs;
+
+      if (n > cnt)
+        n = cnt;
+      if (write)
+        memcpy (sector_addr (rd, sector), buffer, n * BLOCK_SECTOR_SIZE);
+      else
+        memcpy (buffer, sector_addr (rd, sector), n * BLOCK_SECTOR_SIZE);
+
+      sector += n;
+      cnt -= n;
+      ofs += n * BLOCK_SECTOR_SIZE;
+      if (ofs == iov->size)
+        {
+          iov++;
+          ofs = 0;
+        }
+    }
+}
+
+/* Reads sector SECTOR from RAM disk RD into BUFFER. */
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  memcpy (buffer, sector_addr (rd, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SECTOR to RAM disk RD from BUFFER. */
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  memcpy (sector_addr (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SECTOR from RAM disk RD into the
+   buffers in IOV. */
+static void
+ramdisk_read_multi (void *rd, block_sector_t sector, block_sector_t cnt,
+                    const struct block_iovec *iov, size_t iov_cnt UNUSED)
+{
+  ramdisk_copy (rd, sector, cnt, iov, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to RAM disk RD from the
+   buffers in IOV. */
+static void
+ramdisk_write_multi (void *rd, block_sector_t sector, block_sector_t cnt,
+                     const struct block_iovec *iov, size_t iov_cnt UNUSED)
+{
+  ramdisk_copy (rd, sector, cnt, iov, true);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multi,
+    ramdisk_write_multi
+  };
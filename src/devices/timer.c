@@ -18,8 +18,26 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* A list of threads which are sleeping. */
-static struct list sleep_list; 
+/* Sleeping threads are kept in a two-level hierarchical timing
+   wheel, so that registering a sleeper is O(1) and each timer
+   tick only touches the threads that are due.
+
+   A thread that must wake within WHEEL0_SLOTS ticks is kept in
+   wheel0[] at the slot for its wake-up tick.  One that must wake
+   within roughly WHEEL0_SLOTS * WHEEL1_SLOTS ticks is kept in
+   wheel1[], indexed by the high bits of its wake-up tick; each
+   time wheel0 wraps around, the wheel1 slot that is coming due is
+   "cascaded" down into wheel0.  Anything further in the future
+   waits in sleep_overflow and is cascaded whenever wheel1 wraps.
+   All lists are unordered and are accessed only with interrupts
+   off. */
+#define WHEEL0_BITS 8
+#define WHEEL1_BITS 6
+#define WHEEL0_SLOTS (1 << WHEEL0_BITS)
+#define WHEEL1_SLOTS (1 << WHEEL1_BITS)
+static struct list wheel0[WHEEL0_SLOTS];
+static struct list wheel1[WHEEL1_SLOTS];
+static struct list sleep_overflow;
 
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
@@ -33,16 +51,24 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wheel_insert (struct thread *);
+static void wheel_cascade (struct list *);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  int i;
+
+  for (i = 0; i < WHEEL0_SLOTS; i++)
+    list_init (&wheel0[i]);
+  for (i = 0; i < WHEEL1_SLOTS; i++)
+    list_init (&wheel1[i]);
+  list_init (&sleep_overflow);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
-  /* Init Sleep List */ 
-  list_init(&sleep_list); 
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -90,34 +116,38 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
-/* 
-   Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. timer_sleep() suspends execution of the calling thread 
-   until time has advanced at least x timer ticks. Unless the system is 
-   idle, the thread need not wait after exactly x timer ticks. 
-*/
+/* Sleeps for approximately TICKS timer ticks.  Interrupts must
+   be turned on. */
+void
+timer_sleep (int64_t ticks) 
+{
+  if (ticks <= 0)
+    return;
 
+  ASSERT (intr_get_level () == INTR_ON);
+  timer_sleep_until (timer_ticks () + ticks);
+}
 
+/* Sleeps until the timer tick count reaches WAKE_TICK, a value
+   on the same scale as timer_ticks().  Returns immediately if
+   that tick has already passed.  Interrupts must be turned on. */
 void
-timer_sleep (int64_t ticks) 
+timer_sleep_until (int64_t wake_tick) 
 {
-   
-    if(!(ticks >= 0))
-        return; 
-    
-    ASSERT(intr_get_level() == INTR_ON); 
-    
-
-    enum intr_level old_level = intr_disable(); 
-    
-    thread_current()->intr_time = timer_ticks() + ticks; 
-    list_insert_ordered(&sleep_list, &thread_current()->sleep_elem, ordered_sleep, NULL); 
-    thread_block(); 
-    //sema_down(&thread_current()->semaphore_sleep); 
-    
-    intr_set_level(old_level); 
-}    
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  if (wake_tick > ticks)
+    {
+      cur->intr_time = wake_tick;
+      wheel_insert (cur);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+}
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
@@ -194,26 +224,70 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-    ticks++; 
-    thread_tick(); 
-    
-    struct list_elem * e;
-    for(e = list_begin(&sleep_list); e != list_end(&sleep_list); e = list_remove(e))
+  struct list *slot;
+
+  ticks++;
+
+  /* When wheel0 wraps, pull the next block of sleepers down from
+     wheel1, and when wheel1 wraps, from the overflow list. */
+  if ((ticks & (WHEEL0_SLOTS - 1)) == 0)
+    {
+      if (((ticks >> WHEEL0_BITS) & (WHEEL1_SLOTS - 1)) == 0)
+        wheel_cascade (&sleep_overflow);
+      wheel_cascade (&wheel1[(ticks >> WHEEL0_BITS) & (WHEEL1_SLOTS - 1)]);
+    }
+
+  thread_tick ();
+
+  /* Every thread in the current wheel0 slot is due now. */
+  slot = &wheel0[ticks & (WHEEL0_SLOTS - 1)];
+  if (!list_empty (slot))
     {
-        
-        if(ticks < list_entry(e, struct thread, sleep_elem)->intr_time)
-            break;
-        
-        if(timer_ticks() >= list_entry(e, struct thread, sleep_elem)->intr_time)
+      do
         {
-            thread_unblock(list_entry(e, struct thread, sleep_elem)); 
-            //sema_up(&list_entry(e, struct thread, sleep_elem)->semaphore_sleep); 
-            list_pop_front(&sleep_list);     
+          struct thread *t = list_entry (list_pop_front (slot),
+                                         struct thread, sleep_elem);
+          ASSERT (t->intr_time == ticks);
+          thread_unblock (t);
         }
+      while (!list_empty (slot));
+      thread_check_prio (thread_current ());
     }
-    
-    //ticks++; 
-    //thread_tick(); 
+}
+
+/* Files sleeping thread T, whose wake-up tick is T->intr_time,
+   into the timing wheel level that covers its distance from the
+   current tick.  Interrupts must be off. */
+static void
+wheel_insert (struct thread *t)
+{
+  int64_t wake = t->intr_time;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (wake - ticks < WHEEL0_SLOTS)
+    list_push_back (&wheel0[wake & (WHEEL0_SLOTS - 1)], &t->sleep_elem);
+  else if ((wake >> WHEEL0_BITS) - (ticks >> WHEEL0_BITS) < WHEEL1_SLOTS)
+    list_push_back (&wheel1[(wake >> WHEEL0_BITS) & (WHEEL1_SLOTS - 1)],
+                    &t->sleep_elem);
+  else
+    list_push_back (&sleep_overflow, &t->sleep_elem);
+}
+
+/* Re-files every thread on LIST relative to the current tick. */
+static void
+wheel_cascade (struct list *list)
+{
+  struct list pending;
+
+  /* Move LIST aside first, because re-filing may push threads
+     back onto LIST itself (the overflow list). */
+  list_init (&pending);
+  while (!list_empty (list))
+    list_push_back (&pending, list_pop_front (list));
+  while (!list_empty (&pending))
+    wheel_insert (list_entry (list_pop_front (&pending),
+                              struct thread, sleep_elem));
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
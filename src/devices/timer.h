@@ -4,8 +4,6 @@
 #include <round.h>
 #include <stdint.h>
 
-#include "threads/synch.h" 
-
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
@@ -17,6 +15,7 @@ int64_t timer_elapsed (int64_t);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
+void timer_sleep_until (int64_t wake_tick);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
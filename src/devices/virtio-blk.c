@@ -0,0 +1,443 @@
+#include "devices/virtio-blk.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Driver for virtio block devices, using the legacy PCI
+   interface described in [VIRTIO] 0.9.5.
+
+   The device and driver share a ring of descriptors, each
+   naming a buffer in physical memory.  The driver adds a
+   request by chaining descriptors for a header, the data
+   buffers, and a status byte, and putting the chain's head on
+   the "available" ring.  The device puts the heads of completed
+   chains on the "used" ring and interrupts.
+
+   The descriptors are divided into fixed chains of SLOT_DESCS
+   descriptors, called slots, one per outstanding request, so
+   that many requests can be in flight at once.  A transfer with
+   more buffers than fit in one slot is split across several. */
+
+/* PCI IDs of a legacy virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio port addresses, relative to BAR 0. */
+#define reg_host_features(D) ((D)->io_base + 0x00)  /* 32 bits. */
+#define reg_guest_features(D) ((D)->io_base + 0x04) /* 32 bits. */
+#define reg_queue_pfn(D) ((D)->io_base + 0x08)      /* 32 bits. */
+#define reg_queue_size(D) ((D)->io_base + 0x0c)     /* 16 bits. */
+#define reg_queue_select(D) ((D)->io_base + 0x0e)   /* 16 bits. */
+#define reg_queue_notify(D) ((D)->io_base + 0x10)   /* 16 bits. */
+#define reg_status(D) ((D)->io_base + 0x12)         /* 8 bits. */
+#define reg_isr(D) ((D)->io_base + 0x13)            /* 8 bits. */
+#define reg_capacity(D) ((D)->io_base + 0x14)       /* 64 bits. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Driver has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Driver knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver gave up. */
+
+/* Ring alignment required by the legacy interface. */
+#define RING_ALIGN 4096
+
+/* A descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Length of buffer. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 1     /* Chain continues in NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes the buffer. */
+
+/* The available ring, written by the driver. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry goes. */
+    uint16_t ring[];            /* Heads of available chains. */
+  };
+
+/* An entry in the used ring. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of completed chain. */
+    uint32_t len;               /* Bytes written by device. */
+  };
+
+/* The used ring, written by the device. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry goes. */
+    struct vring_used_elem ring[];
+  };
+
+/* Request header. */
+struct virtio_blk_req
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+
+/* Descriptors per slot: a header, up to SLOT_DESCS - 2 data
+   buffers, and a status byte. */
+#define SLOT_DESCS 16
+
+/* Maximum number of slots per device. */
+#define MAX_SLOTS 32
+
+/* Maximum number of devices. */
+#define MAX_DISKS 4
+
+/* A transfer requested through the block layer.  It may be
+   split across several slots. */
+struct transfer
+  {
+    struct semaphore done;      /* Up'd when all slots complete. */
+    int pending;                /* Slots outstanding, plus one. */
+  };
+
+/* An outstanding request. */
+struct slot
+  {
+    struct virtio_blk_req header;       /* Request header. */
+    uint8_t status;                     /* Written by device. */
+    struct transfer *transfer;          /* Transfer this is part of. */
+  };
+
+/* A virtio block device.
+
+   The rings, the slots, and FREE_SLOTS are protected by
+   disabling interrupts, since the interrupt handler completes
+   requests. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt vector. */
+
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    uint16_t last_used;         /* Next used ring entry to process. */
+
+    struct slot *slots;         /* One per chain of descriptors. */
+    size_t slot_cnt;            /* Number of slots. */
+    struct bitmap *free_slots;  /* Slots not in use. */
+    struct semaphore slot_sema; /* Number of free slots. */
+  };
+
+static struct virtio_disk disks[MAX_DISKS];
+static size_t disk_cnt;
+
+static struct block_operations virtio_operations;
+static bool init_disk (struct virtio_disk *, const struct pci_dev *);
+static intr_handler_func interrupt_handler;
+
+/* Detects virtio block devices and registers each one with the
+   block layer. */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev pci;
+  int index;
+
+  for (index = 0; disk_cnt < MAX_DISKS
+         && pci_find_device (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, index, &pci);
+       index++)
+    {
+      struct virtio_disk *d = &disks[disk_cnt];
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      if (init_disk (d, &pci))
+        disk_cnt++;
+    }
+}
+
+/* Initializes disk D, found at PCI location PCI, and registers
+   it.  Returns true if successful, false on failure. */
+static bool
+init_disk (struct virtio_disk *d, const struct pci_dev *pci)
+{
+  uint32_t bar = pci_read_config (pci, PCI_REG_BAR0);
+  size_t avail_ofs, used_ofs, page_cnt, i;
+  block_sector_t capacity;
+  uint8_t *rings;
+  uint8_t line;
+  size_t other;
+  struct block *block;
+
+  if (!(bar & PCI_BAR_IO))
+    {
+      printf ("%s: registers not in I/O space\n", d->name);
+      return false;
+    }
+  d->io_base = bar & ~3u;
+  /* The PIC handles lines 0 through 15.  Firmware reports an
+     unassigned line as 0xff, so check the line before turning it
+     into a vector. */
+  line = pci_read_config (pci, PCI_REG_IRQ) & 0xff;
+  if (line >= 16)
+    {
+      printf ("%s: no usable interrupt line\n", d->name);
+      return false;
+    }
+  d->irq = 0x20 + line;
+  pci_write_config (pci, PCI_REG_COMMAND,
+                    (pci_read_config (pci, PCI_REG_COMMAND)
+                     | PCI_CMD_IO | PCI_CMD_MASTER));
+
+  /* Reset the device and tell it we will drive it.  We need no
+     optional features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (reg_host_features (d));
+  outl (reg_guest_features (d), 0);
+
+  /* Allocate the request queue: the descriptor table and the
+     available ring, then the used ring on the next aligned
+     boundary. */
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  if (d->queue_size < SLOT_DESCS)
+    goto fail;
+  avail_ofs = d->queue_size * sizeof *d->desc;
+  used_ofs = ROUND_UP (avail_ofs + sizeof *d->avail
+                       + (d->queue_size + 1) * sizeof *d->avail->ring,
+                       RING_ALIGN);
+  page_cnt = DIV_ROUND_UP (used_ofs + sizeof *d->used
+                           + (d->queue_size + 1) * sizeof *d->used->ring,
+                           PGSIZE);
+  rings = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (rings == NULL)
+    goto fail;
+  d->desc = (struct vring_desc *) rings;
+  d->avail = (struct vring_avail *) (rings + avail_ofs);
+  d->used = (struct vring_used *) (rings + used_ofs);
+  d->last_used = 0;
+
+  /* Divide the descriptors into slots, each a fixed chain. */
+  d->slot_cnt = d->queue_size / SLOT_DESCS;
+  if (d->slot_cnt > MAX_SLOTS)
+    d->slot_cnt = MAX_SLOTS;
+  d->slots = malloc (d->slot_cnt * sizeof *d->slots);
+  d->free_slots = bitmap_create (d->slot_cnt);
+  if (d->slots == NULL || d->free_slots == NULL)
+    PANIC ("%s: out of memory", d->name);
+  bitmap_set_all (d->free_slots, true);
+  sema_init (&d->slot_sema, d->slot_cnt);
+  for (i = 0; i < d->slot_cnt * SLOT_DESCS; i++)
+    d->desc[i].next = i + 1;
+
+  /* Hand the queue to the device. */
+  outl (reg_queue_pfn (d), vtop (rings) / PGSIZE);
+
+  /* Several disks may share an interrupt line, but only one
+     handler may be registered for it. */
+  for (other = 0; other < disk_cnt; other++)
+    if (disks[other].irq == d->irq)
+      break;
+  if (other == disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  /* Register. */
+  capacity = inl (reg_capacity (d));
+  if (inl (reg_capacity (d) + 4) != 0)
+    capacity = (block_sector_t) -1;
+  block = block_register (d->name, BLOCK_RAW, "virtio", capacity,
+                          &virtio_operations, d);
+  partition_scan (block);
+  return true;
+
+ fail:
+  printf ("%s: queue setup failed\n", d->name);
+  outb (reg_status (d), STATUS_FAILED);
+  return false;
+}
+
+/* Transfers CNT sectors starting at SECTOR between disk D and
+   the buffers in IOV, reading from the disk if WRITE is false
+   and writing to it if WRITE is true.  Waits for the transfer to
+   complete. */
+static void
+transfer (struct virtio_disk *d, block_sector_t sector, block_sector_t cnt,
+          const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  struct transfer t;
+  enum intr_level old_level;
+
+  sema_init (&t.done, 0);
+  t.pending = 1;
+
+  while (cnt > 0)
+    {
+      struct slot *slot;
+      size_t slot_idx, seg_cnt, i;
+      struct vring_desc *desc;
+      block_sector_t n = 0;
+
+      /* Claim a free slot. */
+      sema_down (&d->slot_sema);
+      old_level = intr_disable ();
+      slot_idx = bitmap_scan_and_flip (d->free_slots, 0, 1, true);
+      ASSERT (slot_idx != BITMAP_ERROR);
+      intr_set_level (old_level);
+      slot = &d->slots[slot_idx];
+      desc = &d->desc[slot_idx * SLOT_DESCS];
+
+      /* Fill in its descriptors: as many buffers as fit, between
+         the header and the status byte. */
+      seg_cnt = iov_cnt < SLOT_DESCS - 2 ? iov_cnt : SLOT_DESCS - 2;
+      for (i = 0; i < seg_cnt; i++)
+        {
+          desc[i + 1].addr = vtop (iov[i].base);
+          desc[i + 1].len = iov[i].size;
+          desc[i + 1].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+          n += iov[i].size / BLOCK_SECTOR_SIZE;
+        }
+      slot->header.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+      slot->header.reserved = 0;
+      slot->header.sector = sector;
+      slot->status = 0xff;
+      slot->transfer = &t;
+      desc[0].addr = vtop (&slot->header);
+      desc[0].len = sizeof slot->header;
+      desc[0].flags = VRING_DESC_F_NEXT;
+      desc[0].next = slot_idx * SLOT_DESCS + 1;
+      desc[seg_cnt].next = slot_idx * SLOT_DESCS + seg_cnt + 1;
+      desc[seg_cnt + 1].addr = vtop (&slot->status);
+      desc[seg_cnt + 1].len = 1;
+      desc[seg_cnt + 1].flags = VRING_DESC_F_WRITE;
+
+      /* Make it available and notify the device. */
+      old_level = intr_disable ();
+      t.pending++;
+      d->avail->ring[d->avail->idx % d->queue_size] = slot_idx * SLOT_DESCS;
+      barrier ();
+      d->avail->idx++;
+      barrier ();
+      outw (reg_queue_notify (d), 0);
+      intr_set_level (old_level);
+
+      sector += n;
+      cnt -= n;
+      iov += seg_cnt;
+      iov_cnt -= seg_cnt;
+    }
+
+  /* Wait for every slot to complete. */
+  old_level = intr_disable ();
+  if (--t.pending == 0)
+    sema_up (&t.done);
+  intr_set_level (old_level);
+  sema_down (&t.done);
+}
+
+/* Processes the requests that disk D has completed. */
+static void
+complete_requests (struct virtio_disk *d)
+{
+  while (d->last_used != d->used->idx)
+    {
+      struct vring_used_elem *e
+        = &d->used->ring[d->last_used % d->queue_size];
+      size_t slot_idx = e->id / SLOT_DESCS;
+      struct slot *slot = &d->slots[slot_idx];
+
+      if (slot->status != 0)
+        PANIC ("%s: disk %s failed, sector=%llu", d->name,
+               slot->header.type == VIRTIO_BLK_T_OUT ? "write" : "read",
+               slot->header.sector);
+      if (--slot->transfer->pending == 0)
+        sema_up (&slot->transfer->done);
+      bitmap_reset (d->free_slots, slot_idx);
+      sema_up (&d->slot_sema);
+      d->last_used++;
+    }
+}
+
+/* Virtio interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = &disks[i];
+
+      /* Reading the ISR acknowledges the interrupt. */
+      if (d->irq == f->vec_no && (inb (reg_isr (d)) & 1))
+        complete_requests (d);
+    }
+}
+
+/* Reads CNT sectors starting at SECTOR from disk D into the
+   buffers in IOV. */
+static void
+virtio_read_multi (void *d, block_sector_t sector, block_sector_t cnt,
+                   const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (d, sector, cnt, iov, iov_cnt, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to disk D from the
+   buffers in IOV. */
+static void
+virtio_write_multi (void *d, block_sector_t sector, block_sector_t cnt,
+                    const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (d, sector, cnt, iov, iov_cnt, true);
+}
+
+/* Reads sector SECTOR from disk D into BUFFER. */
+static void
+virtio_read (void *d, block_sector_t sector, void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.base = buffer;
+  iov.size = BLOCK_SECTOR_SIZE;
+  transfer (d, sector, 1, &iov, 1, false);
+}
+
+/* Writes sector SECTOR to disk D from BUFFER. */
+static void
+virtio_write (void *d, block_sector_t sector, const void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.base = (void *) buffer;
+  iov.size = BLOCK_SECTOR_SIZE;
+  transfer (d, sector, 1, &iov, 1, true);
+}
+
+static struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    virtio_read_multi,
+    virtio_write_multi
+  };
@@ -0,0 +1,538 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Interval between write-behind passes, in milliseconds. */
+#define WRITE_BEHIND_MS 5000
+
+/* Maximum number of outstanding read-ahead requests.
+   Requests that arrive while the queue is full are dropped. */
+#define READAHEAD_CNT 16
+
+/* A cached sector.
+
+   The hash index, SECTOR, PIN_CNT, and ACCESSED are protected by
+   cache_lock.  DATA, UP_TO_DATE, and DIRTY are protected by
+   DATA_LOCK, which may only be acquired by a thread that has
+   pinned the block.  A pinned block is never evicted.
+
+   META is set while the block holds metadata changes that the
+   journal has not yet committed.  Such a block must not be
+   written to its home location, so it is neither evicted nor
+   written back until the journal clears META.  META is only
+   changed with both locks held, so either suffices to read it. */
+struct cache_block
+  {
+    struct hash_elem hash_elem;         /* Element in cache_index. */
+    block_sector_t sector;              /* Cached sector, if VALID. */
+    bool valid;                         /* True if SECTOR is meaningful. */
+    int pin_cnt;                        /* Number of active users. */
+    bool accessed;                      /* Clock reference bit. */
+
+    struct lock data_lock;              /* Protects the following. */
+    bool up_to_date;                    /* DATA matches or supersedes disk? */
+    bool dirty;                         /* DATA must be written back? */
+    bool meta;                          /* Held for the journal? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+/* Cache blocks and the index from sector to block. */
+static struct cache_block cache[CACHE_CNT];
+static struct hash cache_index;
+static struct lock cache_lock;
+
+/* Clock hand for eviction. */
+static size_t clock_hand;
+
+/* A read-ahead request. */
+struct readahead
+  {
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* Read-ahead queue, a ring buffer of requests. */
+static struct readahead readahead_queue[READAHEAD_CNT];
+static size_t readahead_head, readahead_cnt;
+static struct lock readahead_lock;
+static struct condition readahead_cond;
+
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static thread_func write_behind_daemon NO_RETURN;
+static thread_func readahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache and starts its helper threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  hash_init (&cache_index, cache_hash, cache_less, NULL);
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      b->valid = false;
+      b->pin_cnt = 0;
+      b->accessed = false;
+      lock_init (&b->data_lock);
+      b->up_to_date = false;
+      b->dirty = false;
+      b->meta = false;
+    }
+  clock_hand = 0;
+
+  readahead_head = readahead_cnt = 0;
+  lock_init (&readahead_lock);
+  cond_init (&readahead_cond);
+
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_daemon, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, readahead_daemon, NULL);
+}
+
+/* Returns the block caching SECTOR, or a null pointer if there
+   is none.  The caller must hold cache_lock. */
+static struct cache_block *
+cache_lookup (block_sector_t sector)
+{
+  struct cache_block key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&cache_index, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_block, hash_elem) : NULL;
+}
+
+/* Advances the clock hand until it finds an unpinned block whose
+   accessed bit is clear, clearing accessed bits along the way.
+   Returns a null pointer if every block is pinned.  The caller
+   must hold cache_lock. */
+static struct cache_block *
+cache_pick_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_CNT;
+
+      if (b->pin_cnt > 0 || b->meta)
+        continue;
+      if (b->valid && b->accessed)
+        {
+          b->accessed = false;
+          continue;
+        }
+      return b;
+    }
+  return NULL;
+}
+
+/* Writes B back to disk if it is dirty and not held for the
+   journal.  The caller must hold B's data lock. */
+static void
+cache_write_back (struct cache_block *b)
+{
+  if (b->dirty && !b->meta)
+    {
+      block_write (fs_device, b->sector, b->data);
+      b->dirty = false;
+    }
+}
+
+/* Obtains the cache block for SECTOR, pinned and with its data
+   lock held.  If LOAD is true, the block's data is read from
+   disk if it is not already up to date; otherwise the caller is
+   expected to overwrite the whole sector. */
+static struct cache_block *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_block *b;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      /* Hit? */
+      b = cache_lookup (sector);
+      if (b != NULL)
+        {
+          b->pin_cnt++;
+          b->accessed = true;
+          lock_release (&cache_lock);
+          lock_acquire (&b->data_lock);
+          break;
+        }
+
+      /* Miss.  Pick a victim, waiting for a block to be unpinned
+         if all of them are in use. */
+      b = cache_pick_victim ();
+      if (b == NULL)
+        {
+          lock_release (&cache_lock);
+          timer_msleep (1);
+          lock_acquire (&cache_lock);
+          continue;
+        }
+
+      /* Write back the victim's old contents without holding
+         cache_lock.  A thread that looks up the old sector in
+         the meantime will pin the victim, in which case we leave
+         it alone and start over. */
+      b->pin_cnt++;
+      lock_release (&cache_lock);
+      lock_acquire (&b->data_lock);
+      if (b->valid)
+        cache_write_back (b);
+      lock_acquire (&cache_lock);
+      if (b->pin_cnt > 1 || cache_lookup (sector) != NULL)
+        {
+          b->pin_cnt--;
+          lock_release (&b->data_lock);
+          continue;
+        }
+
+      /* Reassign the victim to SECTOR. */
+      if (b->valid)
+        hash_delete (&cache_index, &b->hash_elem);
+      b->sector = sector;
+      b->valid = true;
+      b->accessed = true;
+      b->up_to_date = false;
+      b->dirty = false;
+      hash_insert (&cache_index, &b->hash_elem);
+      lock_release (&cache_lock);
+      break;
+    }
+
+  if (load && !b->up_to_date)
+    {
+      block_read (fs_device, b->sector, b->data);
+      b->up_to_date = true;
+    }
+  return b;
+}
+
+/* Releases block B obtained from cache_get(). */
+static void
+cache_put (struct cache_block *b)
+{
+  lock_release (&b->data_lock);
+  lock_acquire (&cache_lock);
+  ASSERT (b->pin_cnt > 0);
+  b->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Copies SIZE bytes starting at offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  b = cache_get (sector, true);
+  memcpy (buffer, b->data + ofs, size);
+  cache_put (b);
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR, starting at offset
+   OFS within the sector.  The sector is read from disk first
+   only if the write does not cover all of it. */
+void
+cache_write (block_sector_t sector, const void *buffer,
+             off_t ofs, off_t size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  b = cache_get (sector, ofs != 0 || size != BLOCK_SECTOR_SIZE);
+  memcpy (b->data + ofs, buffer, size);
+  b->up_to_date = true;
+  b->dirty = true;
+  cache_put (b);
+}
+
+/* Like cache_write(), but for metadata: the sector is held in the
+   cache, and not written to its home location, until
+   cache_release_meta() is called for it after the journal has
+   committed the change. */
+void
+cache_write_meta (block_sector_t sector, const void *buffer,
+                  off_t ofs, off_t size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  b = cache_get (sector, ofs != 0 || size != BLOCK_SECTOR_SIZE);
+  memcpy (b->data + ofs, buffer, size);
+  b->up_to_date = true;
+  b->dirty = true;
+  lock_acquire (&cache_lock);
+  b->meta = true;
+  lock_release (&cache_lock);
+  cache_put (b);
+}
+
+/* Allows SECTOR, previously written with cache_write_meta(), to
+   be written to its home location. */
+void
+cache_release_meta (block_sector_t sector)
+{
+  struct cache_block *b;
+
+  lock_acquire (&cache_lock);
+  b = cache_lookup (sector);
+  ASSERT (b != NULL);
+  b->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&b->data_lock);
+  lock_acquire (&cache_lock);
+  b->meta = false;
+  lock_release (&cache_lock);
+  cache_put (b);
+}
+
+/* Fills SECTOR with zeros without reading it from disk. */
+void
+cache_zero (block_sector_t sector)
+{
+  struct cache_block *b = cache_get (sector, false);
+  memset (b->data, 0, BLOCK_SECTOR_SIZE);
+  b->up_to_date = true;
+  b->dirty = true;
+  cache_put (b);
+}
+
+/* Reads the CNT blocks in RUN, which are pinned, have their
+   data locks held, and cache consecutive sectors, from disk in
+   a single request, then releases them. */
+static void
+read_run (struct cache_block **run, size_t cnt)
+{
+  struct block_iovec iov[CACHE_RUN_MAX];
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= CACHE_RUN_MAX);
+  for (i = 0; i < cnt; i++)
+    {
+      iov[i].base = run[i]->data;
+      iov[i].size = BLOCK_SECTOR_SIZE;
+    }
+  block_read_multi (fs_device, run[0]->sector, cnt, iov, cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      run[i]->up_to_date = true;
+      cache_put (run[i]);
+    }
+}
+
+/* Writes the CNT blocks in RUN, as for read_run(), to disk in a
+   single request, then releases them. */
+static void
+write_run (struct cache_block **run, size_t cnt)
+{
+  struct block_iovec iov[CACHE_RUN_MAX];
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= CACHE_RUN_MAX);
+  for (i = 0; i < cnt; i++)
+    {
+      iov[i].base = run[i]->data;
+      iov[i].size = BLOCK_SECTOR_SIZE;
+    }
+  block_write_multi (fs_device, run[0]->sector, cnt, iov, cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      run[i]->dirty = false;
+      cache_put (run[i]);
+    }
+}
+
+/* Writes every dirty block in the cache to disk.  Dirty blocks
+   for consecutive sectors are written together, in requests of
+   up to CACHE_RUN_MAX sectors. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *run[CACHE_RUN_MAX];
+      struct cache_block *b = &cache[i];
+      size_t cnt;
+
+      lock_acquire (&cache_lock);
+      if (!b->valid)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      b->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&b->data_lock);
+      if (!b->dirty || b->meta)
+        {
+          cache_put (b);
+          continue;
+        }
+
+      /* Extend the run over dirty blocks for the sectors that
+         follow, skipping any that are in use rather than waiting
+         for them while holding the run. */
+      run[0] = b;
+      for (cnt = 1; cnt < CACHE_RUN_MAX; cnt++)
+        {
+          struct cache_block *next;
+
+          lock_acquire (&cache_lock);
+          next = cache_lookup (b->sector + cnt);
+          if (next != NULL && lock_try_acquire (&next->data_lock))
+            next->pin_cnt++;
+          else
+            next = NULL;
+          lock_release (&cache_lock);
+          if (next == NULL)
+            break;
+          if (!next->dirty || next->meta)
+            {
+              cache_put (next);
+              break;
+            }
+          run[cnt] = next;
+        }
+      write_run (run, cnt);
+    }
+}
+
+/* Brings those of the CNT sectors starting at SECTOR that are
+   not already cached into the cache, reading each run of
+   consecutive missing sectors, up to CACHE_RUN_MAX at a time,
+   with a single request. */
+void
+cache_prefetch (block_sector_t sector, size_t cnt)
+{
+  struct cache_block *run[CACHE_RUN_MAX];
+  size_t run_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_block *b = NULL;
+      bool cached;
+
+      lock_acquire (&cache_lock);
+      cached = cache_lookup (sector + i) != NULL;
+      lock_release (&cache_lock);
+      if (!cached)
+        {
+          b = cache_get (sector + i, false);
+          if (b->up_to_date)
+            {
+              cache_put (b);
+              b = NULL;
+            }
+        }
+
+      if (b != NULL)
+        run[run_cnt++] = b;
+      if (run_cnt > 0 && (b == NULL || run_cnt == CACHE_RUN_MAX))
+        {
+          read_run (run, run_cnt);
+          run_cnt = 0;
+        }
+    }
+  if (run_cnt > 0)
+    read_run (run, run_cnt);
+}
+
+/* Asks the read-ahead thread to bring the CNT sectors starting
+   at SECTOR into the cache.  Returns immediately.  The request
+   is dropped if SECTOR is already cached or the read-ahead queue
+   is full. */
+void
+cache_readahead (block_sector_t sector, size_t cnt)
+{
+  bool cached;
+
+  lock_acquire (&cache_lock);
+  cached = cache_lookup (sector) != NULL;
+  lock_release (&cache_lock);
+  if (cached)
+    return;
+
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_CNT)
+    {
+      struct readahead *r
+        = &readahead_queue[(readahead_head + readahead_cnt++)
+                           % READAHEAD_CNT];
+      r->sector = sector;
+      r->cnt = cnt;
+      cond_signal (&readahead_cond, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Periodically writes dirty blocks back to disk, so that a crash
+   loses at most WRITE_BEHIND_MS worth of writes. */
+static void
+write_behind_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_msleep (WRITE_BEHIND_MS);
+      cache_flush ();
+    }
+}
+
+/* Services read-ahead requests queued by cache_readahead(). */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct readahead r;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_cond, &readahead_lock);
+      r = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_CNT;
+      readahead_cnt--;
+      lock_release (&readahead_lock);
+
+      cache_prefetch (r.sector, r.cnt);
+    }
+}
+
+/* Returns a hash value for the sector cached in block E. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_block *b = hash_entry (e, struct cache_block, hash_elem);
+  return hash_int (b->sector);
+}
+
+/* Returns true if block A caches a lower sector than block B. */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct cache_block *a = hash_entry (a_, struct cache_block, hash_elem);
+  const struct cache_block *b = hash_entry (b_, struct cache_block, hash_elem);
+  return a->sector < b->sector;
+}
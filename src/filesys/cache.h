@@ -0,0 +1,28 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Number of sectors held in the buffer cache.
+   May be overridden at build time, e.g. with -DCACHE_CNT=128. */
+#ifndef CACHE_CNT
+#define CACHE_CNT 64
+#endif
+
+/* Maximum number of sectors that cache_prefetch() and
+   cache_flush() combine into a single device request. */
+#define CACHE_RUN_MAX (CACHE_CNT / 4 < 16 ? CACHE_CNT / 4 : 16)
+
+void cache_init (void);
+void cache_flush (void);
+void cache_read (block_sector_t, void *, off_t ofs, off_t size);
+void cache_write (block_sector_t, const void *, off_t ofs, off_t size);
+void cache_write_meta (block_sector_t, const void *, off_t ofs, off_t size);
+void cache_release_meta (block_sector_t);
+void cache_zero (block_sector_t);
+void cache_prefetch (block_sector_t, size_t cnt);
+void cache_readahead (block_sector_t, size_t cnt);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,176 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Caches the result of looking up NAME in the directory whose
+   inode is in sector DIR, keyed by (DIR, NAME).  A "negative"
+   entry, whose SECTOR is DCACHE_NEGATIVE, records that the name
+   does not exist.  The directory code invalidates an entry
+   whenever it adds or removes the corresponding name, and all of
+   a directory's entries when the directory itself is removed.
+   The cache holds at most DCACHE_CNT entries, discarding the
+   least recently used one to make room for a new one. */
+
+/* A cached directory entry. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache_index. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    block_sector_t dir;                 /* Directory inode sector. */
+    char name[NAME_MAX + 1];            /* Name within DIR. */
+    block_sector_t sector;              /* Inode sector, or negative. */
+  };
+
+static struct hash dcache_index;        /* All entries, by (DIR, NAME). */
+static struct list dcache_lru;          /* All entries, most recent first. */
+static struct lock dcache_lock;         /* Protects the above. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dcache_index, dentry_hash, dentry_less, NULL);
+  list_init (&dcache_lru);
+  lock_init (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there
+   is none.  The caller must hold dcache_lock. */
+static struct dentry *
+dentry_find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache_index, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Removes entry D from the cache and frees it.
+   The caller must hold dcache_lock. */
+static void
+dentry_discard (struct dentry *d)
+{
+  hash_delete (&dcache_index, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  free (d);
+}
+
+/* Looks up NAME in DIR.  If the cache has an entry for it,
+   stores the inode sector that NAME refers to in *SECTORP, or
+   DCACHE_NEGATIVE if NAME is known not to exist, and returns
+   true.  Returns false if the cache has no entry. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&dcache_lru, &d->lru_elem);
+      *sectorp = d->sector;
+    }
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME in DIR refers to the inode in SECTOR, or,
+   if SECTOR is DCACHE_NEGATIVE, that it does not exist. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d == NULL)
+    {
+      if (hash_size (&dcache_index) >= DCACHE_CNT)
+        dentry_discard (list_entry (list_back (&dcache_lru),
+                                    struct dentry, lru_elem));
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        goto done;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache_index, &d->hash_elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+  d->sector = sector;
+  list_push_front (&dcache_lru, &d->lru_elem);
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* Discards any entry for NAME in DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    dentry_discard (d);
+  lock_release (&dcache_lock);
+}
+
+/* Discards every entry for a name in DIR. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        dentry_discard (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
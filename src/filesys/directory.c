@@ -1,16 +1,27 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
+#include <stddef.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Identifies a hashed directory. */
+#define DIR_MAGIC 0x48534844
+
+/* Number of hash buckets in a hashed directory. */
+#define DIR_BUCKET_CNT 256
+
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    bool hashed;                        /* Hashed or linear format? */
   };
 
 /* A single directory entry. */
@@ -21,12 +32,141 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Hashed directories.
+
+   A directory is either linear, an array of struct dir_entry, or
+   hashed.  A hashed directory is divided into blocks of
+   BLOCK_SECTOR_SIZE bytes.  Block 0 holds a struct dir_header.
+   Blocks 1 through DIR_BUCKET_CNT are the heads of the hash
+   buckets, and later blocks are overflow blocks chained from
+   them.  Each of these is a struct dir_bucket.  Since inodes
+   allocate sectors only when they are written, empty buckets
+   take up no disk space.
+
+   Directories created by dir_create() are hashed.  Linear
+   directories are still read and written in place; their parent
+   is taken to be the root directory.
+
+   "." and ".." are not stored as entries.  dir_lookup() resolves
+   them from the directory itself and the header's PARENT. */
+
+/* Header in block 0 of a hashed directory. */
+struct dir_header
+  {
+    uint32_t magic;                     /* DIR_MAGIC. */
+    uint32_t bucket_cnt;                /* Number of hash buckets. */
+    uint32_t block_cnt;                 /* Blocks in use, incl. header. */
+    uint32_t entry_cnt;                 /* Number of entries in use. */
+    block_sector_t parent;              /* Parent directory's inode. */
+  };
+
+/* Number of entries in a bucket block. */
+#define DIR_BUCKET_ENTRIES 25
+
+/* A hash bucket or overflow block in a hashed directory.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+  {
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+    uint32_t next;                      /* Next overflow block, or 0. */
+    uint8_t unused[8];                  /* Not used. */
+  };
+
+/* Returns the byte offset of block number BLOCK in a hashed
+   directory. */
+static off_t
+block_ofs (uint32_t block)
+{
+  return block * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the byte offset of entry IDX in hashed directory block
+   BLOCK. */
+static off_t
+entry_ofs (uint32_t block, size_t idx)
+{
+  return block_ofs (block) + idx * sizeof (struct dir_entry);
+}
+
+/* Reads the header of hashed directory DIR into *H.
+   Returns true if successful, false on error. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h)
+{
+  return inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Returns the first block of the bucket for NAME in DIR, whose
+   header is H. */
+static uint32_t
+bucket_for (const struct dir_header *h, const char *name)
+{
+  return 1 + hash_string (name) % h->bucket_cnt;
+}
+
+/* Creates a directory in the given SECTOR, whose parent directory
+   is in sector PARENT.  Returns true if successful, false on
+   failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct inode *inode;
+  bool success;
+
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  if (!inode_create (sector, 0, true))
+    return false;
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+
+  h.magic = DIR_MAGIC;
+  h.bucket_cnt = DIR_BUCKET_CNT;
+  h.block_cnt = 1 + DIR_BUCKET_CNT;
+  h.entry_cnt = 0;
+  h.parent = parent;
+  success = inode_write_at (inode, &h, sizeof h, 0) == sizeof h;
+  inode_close (inode);
+  return success;
+}
+
+/* Adds DELTA to the entry count of DIR, if it is hashed.
+   Returns true if successful, false on error. */
+static bool
+adjust_entry_cnt (struct dir *dir, int delta)
+{
+  struct dir_header h;
+
+  if (!dir->hashed)
+    return true;
+  if (!read_header (dir, &h))
+    return false;
+  h.entry_cnt += delta;
+  return inode_write_at (dir->inode, &h, sizeof h, 0) == sizeof h;
+}
+
+/* Returns true if DIR contains no entries. */
+static bool
+dir_is_empty (struct dir *dir)
+{
+  if (dir->hashed)
+    {
+      struct dir_header h;
+      return read_header (dir, &h) && h.entry_cnt == 0;
+    }
+  else
+    {
+      struct dir_entry e;
+      off_t ofs;
+
+      for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+           ofs += sizeof e)
+        if (e.in_use)
+          return false;
+      return true;
+    }
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -37,8 +177,11 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      struct dir_header h;
+
       dir->inode = inode;
-      dir->pos = 0;
+      dir->hashed = read_header (dir, &h) && h.magic == DIR_MAGIC;
+      dir->pos = dir->hashed ? block_ofs (1) : 0;
       return dir;
     }
   else
@@ -83,21 +226,18 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Searches linear directory DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
    otherwise, returns false and ignores EP and OFSP. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+linear_lookup (const struct dir *dir, const char *name,
+               struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
   size_t ofs;
   
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
-
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -111,23 +251,194 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+/* Searches the bucket for NAME in hashed directory DIR.
+   If NAME is found, returns true, sets *EP to the directory
+   entry if EP is non-null, and sets *OFSP to the byte offset of
+   the directory entry if OFSP is non-null.
+   Otherwise, returns false.  In that case, if FREEP is non-null,
+   sets *FREEP to the byte offset of the first free slot in the
+   bucket, or to 0 if the bucket is full, and sets *LASTP to the
+   last block in the bucket's chain.
+   Also returns false if memory allocation fails. */
+static bool
+hashed_lookup (const struct dir *dir, const char *name,
+               struct dir_entry *ep, off_t *ofsp,
+               off_t *freep, uint32_t *lastp)
+{
+  struct dir_header h;
+  struct dir_bucket *b;
+  uint32_t block;
+  bool found = false;
+
+  if (freep != NULL)
+    *freep = 0;
+  if (!read_header (dir, &h))
+    return false;
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
+  for (block = bucket_for (&h, name); ; block = b->next)
+    {
+      size_t i;
+
+      if (inode_read_at (dir->inode, b, sizeof *b, block_ofs (block))
+          != sizeof *b)
+        memset (b, 0, sizeof *b);
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        {
+          struct dir_entry *e = &b->entries[i];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = entry_ofs (block, i);
+              found = true;
+              goto done;
+            }
+          else if (!e->in_use && freep != NULL && *freep == 0)
+            *freep = entry_ofs (block, i);
+        }
+      if (b->next == 0)
+        break;
+    }
+  if (lastp != NULL)
+    *lastp = block;
+
+ done:
+  free (b);
+  return found;
+}
+
+/* Searches DIR for a file with the given NAME.
+   If successful, returns true, sets *EP to the directory entry
+   if EP is non-null, and sets *OFSP to the byte offset of the
+   directory entry if OFSP is non-null.
+   otherwise, returns false and ignores EP and OFSP. */
+static bool
+lookup (const struct dir *dir, const char *name,
+        struct dir_entry *ep, off_t *ofsp) 
+{
+  ASSERT (dir != NULL);
+  ASSERT (name != NULL);
+
+  if (dir->hashed)
+    return hashed_lookup (dir, name, ep, ofsp, NULL, NULL);
+  else
+    return linear_lookup (dir, name, ep, ofsp);
+}
+
+/* Finds a free slot for NAME in hashed directory DIR, adding an
+   overflow block to NAME's bucket if it is full, and stores its
+   byte offset in *OFSP.
+   Returns false if NAME is already in DIR or on failure. */
+static bool
+hashed_find_slot (struct dir *dir, const char *name, off_t *ofsp)
+{
+  struct dir_header h;
+  uint32_t last, block;
+
+  if (hashed_lookup (dir, name, NULL, NULL, ofsp, &last))
+    return false;
+  if (*ofsp != 0)
+    return true;
+
+  /* Bucket is full.  Chain a new overflow block after LAST. */
+  if (!read_header (dir, &h))
+    return false;
+  block = h.block_cnt++;
+  if (inode_write_at (dir->inode, &h, sizeof h, 0) != sizeof h
+      || (inode_write_at (dir->inode, &block, sizeof block,
+                          block_ofs (last) + offsetof (struct dir_bucket, next))
+          != sizeof block))
+    return false;
+  *ofsp = entry_ofs (block, 0);
+  return true;
+}
+
+/* Finds a free slot for NAME in linear directory DIR and stores
+   its byte offset in *OFSP.
+   Returns false if NAME is already in DIR. */
+static bool
+linear_find_slot (struct dir *dir, const char *name, off_t *ofsp)
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  /* Check that NAME is not in use. */
+  if (linear_lookup (dir, name, NULL, NULL))
+    return false;
+
+  /* Set OFS to offset of free slot.
+     If there are no free slots, then it will be set to the
+     current end-of-file.
+     
+     inode_read_at() will only return a short read at end of file.
+     Otherwise, we'd need to verify that we didn't get a short
+     read due to something intermittent such as low memory. */
+  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e) 
+    if (!e.in_use)
+      break;
+  *ofsp = ofs;
+  return true;
+}
+
+/* Returns true if NAME is "." or "..". */
+static bool
+is_dot_name (const char *name)
+{
+  return !strcmp (name, ".") || !strcmp (name, "..");
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
+   "." names DIR itself and ".." its parent.
+   Nothing can be found in a directory that has been removed.
    On success, sets *INODE to an inode for the file, otherwise to
    a null pointer.  The caller must close *INODE. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t dir_sector;
+  block_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  *inode = NULL;
+  if (inode_is_removed (dir->inode))
+    return false;
+
+  dir_sector = inode_get_inumber (dir->inode);
+  if (!strcmp (name, "."))
+    *inode = inode_reopen (dir->inode);
+  else if (!strcmp (name, ".."))
+    {
+      struct dir_header h;
+      if (!dir->hashed)
+        *inode = inode_open (ROOT_DIR_SECTOR);
+      else if (read_header (dir, &h))
+        *inode = inode_open (h.parent);
+    }
+  else if (dcache_lookup (dir_sector, name, &sector))
+    {
+      if (sector != DCACHE_NEGATIVE)
+        *inode = inode_open (sector);
+    }
   else
-    *inode = NULL;
+    {
+      struct dir_entry e;
+      if (lookup (dir, name, &e, NULL))
+        {
+          dcache_insert (dir_sector, name, e.inode_sector);
+          *inode = inode_open (e.inode_sector);
+        }
+      else
+        dcache_insert (dir_sector, name, DCACHE_NEGATIVE);
+    }
 
   return *inode != NULL;
 }
@@ -136,8 +447,9 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. empty, too long, "." or "..")
+   or DIR has been removed, or if a disk or memory error
+   occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
@@ -149,38 +461,35 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX || is_dot_name (name))
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  /* Refuse to add to a removed directory. */
+  if (inode_is_removed (dir->inode))
+    return false;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Find a slot, checking that NAME is not in use. */
+  if (dir->hashed
+      ? !hashed_find_slot (dir, name, &ofs)
+      : !linear_find_slot (dir, name, &ofs))
+    goto done;
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = (inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+             && adjust_entry_cnt (dir, 1));
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
 
  done:
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME or if NAME is a directory
+   that is not empty. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
@@ -201,12 +510,26 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only empty directories may be removed. */
+  if (inode_is_dir (inode))
+    {
+      struct dir *victim = dir_open (inode_reopen (inode));
+      bool empty = victim != NULL && dir_is_empty (victim);
+      dir_close (victim);
+      if (!empty)
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  adjust_entry_cnt (dir, -1);
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
 
   /* Remove inode. */
+  if (inode_is_dir (inode))
+    dcache_invalidate_dir (inode_get_inumber (inode));
   inode_remove (inode);
   success = true;
 
@@ -223,8 +546,16 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  for (;;)
     {
+      /* Skip the trailer of each hashed directory block. */
+      if (dir->hashed
+          && (dir->pos % BLOCK_SECTOR_SIZE
+              >= DIR_BUCKET_ENTRIES * (off_t) sizeof e))
+        dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
+
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
@@ -2,10 +2,14 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,7 +25,10 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
+  journal_init (format);
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
@@ -36,8 +43,142 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_done ();
+  cache_flush ();
 }
 
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX character from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Resolves every component of PATH except the last, starting
+   from the root directory if PATH is absolute and from the
+   current thread's working directory otherwise.  Stores the
+   last component in NAME, or the empty string if PATH has no
+   components (e.g. "/"), and returns the directory that should
+   contain it, which the caller must close.
+   Returns a null pointer if a component is too long, does not
+   exist, or is not a directory, or if memory allocation fails. */
+static struct dir *
+resolve_parent (const char *path, char name[NAME_MAX + 1])
+{
+  struct dir *cwd = thread_current ()->cwd;
+  char next[NAME_MAX + 1];
+  struct dir *dir;
+  int result;
+
+  dir = *path == '/' || cwd == NULL ? dir_open_root () : dir_reopen (cwd);
+  if (dir == NULL)
+    return NULL;
+
+  result = get_next_part (name, &path);
+  if (result == 0)
+    *name = '\0';
+  while (result > 0 && (result = get_next_part (next, &path)) > 0)
+    {
+      /* NAME is an intermediate component.  Descend into it. */
+      struct inode *inode;
+
+      if (!dir_lookup (dir, name, &inode) || !inode_is_dir (inode))
+        {
+          inode_close (inode);
+          result = -1;
+          break;
+        }
+      dir_close (dir);
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return NULL;
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+
+  if (result < 0)
+    {
+      dir_close (dir);
+      return NULL;
+    }
+  return dir;
+}
+
+/* Creates an inode for a file named NAME, or a directory if
+   IS_DIR is true, with the given INITIAL_SIZE.
+   Returns true if successful, false otherwise. */
+static bool
+create (const char *name, off_t initial_size, bool is_dir)
+{
+  char base[NAME_MAX + 1];
+  block_sector_t inode_sector = 0;
+  struct dir *dir = resolve_parent (name, base);
+  bool created = false;
+  bool success = false;
+
+  journal_begin ();
+
+  /* Put a file's inode near its directory, and a directory in a
+     group with plenty of room for its children. */
+  if (dir != NULL && *base != '\0'
+      && free_map_allocate_near (1, (is_dir
+                                     ? free_map_dir_goal ()
+                                     : inode_get_inumber (dir_get_inode (dir))),
+                                 &inode_sector))
+    {
+      if (is_dir)
+        created = dir_create (inode_sector,
+                              inode_get_inumber (dir_get_inode (dir)));
+      else
+        created = inode_create (inode_sector, initial_size, false);
+      success = created && dir_add (dir, base, inode_sector);
+    }
+  if (!success && inode_sector != 0)
+    {
+      /* Removing the inode also frees any blocks it allocated. */
+      struct inode *inode = created ? inode_open (inode_sector) : NULL;
+      if (inode != NULL)
+        {
+          inode_remove (inode);
+          inode_close (inode);
+        }
+      else
+        {
+          free_map_release (inode_sector, 1);
+          free_map_flush ();
+        }
+    }
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -45,20 +186,42 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
+  return create (name, initial_size, false);
+}
+
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  return create (name, 0, true);
+}
+
+/* Opens the inode for the file or directory with the given
+   NAME.  Returns the new inode if successful or a null pointer
+   otherwise. */
+static struct inode *
+open_inode (const char *name)
+{
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve_parent (name, base);
+  struct inode *inode = NULL;
+
+  if (dir != NULL)
+    {
+      if (*base != '\0')
+        dir_lookup (dir, base, &inode);
+      else if (*name != '\0')
+        inode = inode_reopen (dir_get_inode (dir));
+    }
   dir_close (dir);
 
-  return success;
+  return inode;
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,37 +229,81 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  struct inode *inode = NULL;
+  return file_open (open_inode (name));
+}
 
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
-  dir_close (dir);
+/* Opens the directory with the given NAME.
+   Returns the new directory if successful or a null pointer
+   otherwise.
+   Fails if no directory named NAME exists,
+   or if an internal memory allocation fails. */
+struct dir *
+filesys_opendir (const char *name)
+{
+  struct inode *inode = open_inode (name);
+
+  if (inode != NULL && !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return NULL;
+    }
+  return dir_open (inode);
+}
+
+/* Changes the current thread's working directory to NAME.
+   Returns true if successful, false on failure. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *cur = thread_current ();
+  struct dir *dir = filesys_opendir (name);
 
-  return file_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (cur->cwd);
+  cur->cwd = dir;
+  return true;
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if NAME is a directory that
+   is not empty, or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char base[NAME_MAX + 1];
+  struct dir *dir;
+  struct inode *inode = NULL;
+  bool success;
+
+  /* Hold our own reference to the inode, so that if this removes
+     the last link and no one else has it open, its blocks are
+     freed by the inode_close() below, as an operation of its own
+     that may commit in several steps, instead of inside this
+     one. */
+  journal_begin ();
+  dir = resolve_parent (name, base);
+  success = (dir != NULL && *base != '\0'
+             && dir_lookup (dir, base, &inode)
+             && dir_remove (dir, base));
   dir_close (dir); 
+  journal_end ();
+  inode_close (inode);
 
   return success;
 }
-
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  /* Not one operation: writing out the free map may take more
+     sectors than a transaction holds.  A crash midway through
+     formatting calls for formatting again anyway. */
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
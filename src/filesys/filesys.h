@@ -8,13 +8,19 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+struct dir;
+struct file;
+
 /* Block device that contains the file system. */
 struct block *fs_device;
 
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
+bool filesys_mkdir (const char *name);
 struct file *filesys_open (const char *name);
+struct dir *filesys_opendir (const char *name);
+bool filesys_chdir (const char *name);
 bool filesys_remove (const char *name);
 
 #endif /* filesys/filesys.h */
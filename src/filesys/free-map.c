@@ -1,13 +1,85 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file whose bits free_map_release() has
+   changed but not yet written.  Releases are written in batches,
+   by free_map_flush() at the end of an operation or as soon as
+   DIRTY_MAX free map sectors are waiting, which bounds how much
+   one flush adds to the running journal transaction. */
+#define SECTOR_BITS (BLOCK_SECTOR_SIZE * 8)
+#define DIRTY_MAX 8
+static struct bitmap *dirty_map;     /* One bit per free map sector. */
+static size_t dirty_cnt;             /* Number of bits set in DIRTY_MAP. */
+
+/* Block groups.
+
+   The disk is divided into groups of GROUP_SECTORS consecutive
+   sectors.  Allocations search outward from a goal sector, one
+   group at a time, skipping groups that do not have enough free
+   sectors according to GROUP_FREE, so that related data (a
+   file's blocks and its inode, a directory and its children)
+   tends to end up close together. */
+#define GROUP_SECTORS 1024
+
+static size_t group_cnt;             /* Number of groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+
+/* Returns the group that contains SECTOR. */
+static size_t
+group_of (block_sector_t sector)
+{
+  return sector / GROUP_SECTORS;
+}
+
+/* Returns the number of sectors in GROUP, which is less than
+   GROUP_SECTORS only for the last group. */
+static size_t
+group_size (size_t group)
+{
+  size_t start = group * GROUP_SECTORS;
+  size_t end = start + GROUP_SECTORS;
+  size_t disk_size = bitmap_size (free_map);
+  return (end < disk_size ? end : disk_size) - start;
+}
+
+/* Recomputes every group's free count from the free map. */
+static void
+count_groups (void)
+{
+  size_t i;
+
+  for (i = 0; i < group_cnt; i++)
+    group_free[i] = bitmap_count (free_map, i * GROUP_SECTORS,
+                                  group_size (i), false);
+}
+
+/* Adds DELTA to the free count of each group, once for each of
+   the CNT sectors starting at SECTOR that it contains. */
+static void
+adjust_groups (block_sector_t sector, size_t cnt, int delta)
+{
+  while (cnt > 0)
+    {
+      size_t group = group_of (sector);
+      size_t group_end = group * GROUP_SECTORS + group_size (group);
+      size_t n = group_end - sector < cnt ? group_end - sector : cnt;
+
+      group_free[group] += delta * (int) n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -17,36 +89,157 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                           SECTOR_BITS));
+  if (dirty_map == NULL)
+    PANIC ("free map dirty bitmap creation failed");
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("block group table allocation failed");
+  count_groups ();
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Finds CNT consecutive free sectors as close after GOAL as
+   possible, marks them allocated, and returns the first, or
+   BITMAP_ERROR if there is no such run. */
+static size_t
+scan_near (size_t cnt, block_sector_t goal)
+{
+  size_t disk_size = bitmap_size (free_map);
+  size_t first = group_of (goal < disk_size ? goal : 0);
+  size_t i;
+
+  /* Try each group in turn, starting at GOAL's group, for runs
+     that fit within a single group. */
+  if (cnt <= GROUP_SECTORS)
+    for (i = 0; i < group_cnt; i++)
+      {
+        size_t group = (first + i) % group_cnt;
+        size_t start = group * GROUP_SECTORS;
+        size_t end = start + group_size (group);
+        size_t sector;
+
+        if (group_free[group] < cnt)
+          continue;
+        if (i == 0 && goal > start && goal < end)
+          start = goal;
+        sector = bitmap_scan (free_map, start, cnt, false);
+        if (sector != BITMAP_ERROR && sector + cnt <= end)
+          {
+            bitmap_set_multiple (free_map, sector, cnt, true);
+            return sector;
+          }
+      }
+
+  /* Fall back to first fit over the whole disk, which also finds
+     runs that span groups. */
+  return bitmap_scan_and_flip (free_map, 0, cnt, false);
+}
+
+/* Writes the part of the free map covering the CNT sectors
+   starting at SECTOR to the free map file, if it is open.
+   Returns true if successful, false on failure. */
+static bool
+write_range (block_sector_t sector, size_t cnt)
+{
+  return (free_map_file == NULL
+          || bitmap_write_range (free_map, free_map_file, sector, cnt));
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   after sector GOAL as possible, and stores the first into
+   *SECTORP.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
    written. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector = scan_near (cnt, goal);
+  if (sector != BITMAP_ERROR && !write_range (sector, cnt))
     {
       bitmap_set_multiple (free_map, sector, cnt, false); 
       sector = BITMAP_ERROR;
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      adjust_groups (sector, cnt, -1);
+      *sectorp = sector;
+    }
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates CNT consecutive sectors from the free map and stores
+   the first into *SECTORP, with no preference for placement.
+   Returns true if successful, false on failure. */
+bool
+free_map_allocate (size_t cnt, block_sector_t *sectorp)
+{
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Returns a goal sector for a new directory: the start of the
+   group with the most free sectors, so that directories, and the
+   files later placed near them, spread out over the disk. */
+block_sector_t
+free_map_dir_goal (void)
+{
+  size_t best = 0;
+  size_t i;
+
+  for (i = 1; i < group_cnt; i++)
+    if (group_free[i] > group_free[best])
+      best = i;
+  return best * GROUP_SECTORS;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.
+   The change reaches the free map file by the next
+   free_map_flush(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  size_t i;
+
+  ASSERT (cnt > 0);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  adjust_groups (sector, cnt, 1);
+  journal_release (sector, cnt);
+
+  for (i = sector / SECTOR_BITS; i <= (sector + cnt - 1) / SECTOR_BITS; i++)
+    if (!bitmap_test (dirty_map, i))
+      {
+        bitmap_mark (dirty_map, i);
+        dirty_cnt++;
+      }
+  if (dirty_cnt >= DIRTY_MAX)
+    free_map_flush ();
+}
+
+/* Writes the free map sectors changed by free_map_release() to
+   the free map file. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  if (dirty_cnt == 0)
+    return;
+  for (i = 0; i < bitmap_size (dirty_map); i++)
+    if (bitmap_test (dirty_map, i))
+      {
+        size_t start = i * SECTOR_BITS;
+        size_t cnt = bitmap_size (free_map) - start;
+        write_range (start, cnt < SECTOR_BITS ? cnt : SECTOR_BITS);
+      }
+  bitmap_set_all (dirty_map, false);
+  dirty_cnt = 0;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,12 +251,14 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
 }
 
@@ -72,14 +267,24 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The file's sectors are allocated by
+     the first write, which may mark bits that were already
+     written out, so write the bitmap a second time once every
+     sector is in place.  Leaving free_map_file null until then
+     keeps free_map_allocate() from writing the bitmap
+     recursively. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
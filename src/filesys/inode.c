@@ -1,108 +1,683 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* Identifies an inode. */
+/* Identifies an inode that maps its data with a block map. */
 #define INODE_MAGIC 0x494e4f44
 
-/* On-disk inode.
+/* Identifies an inode that maps its data with extents. */
+#define EXTENT_MAGIC 0x45585453
+
+/* Number of sector pointers of each kind in an inode. */
+#define DIRECT_CNT 123                  /* Direct data sectors. */
+#define INDIRECT_CNT 1                  /* Indirect blocks. */
+#define DBL_INDIRECT_CNT 1              /* Doubly indirect blocks. */
+#define SECTOR_CNT (DIRECT_CNT + INDIRECT_CNT + DBL_INDIRECT_CNT)
+
+/* Number of sector pointers in an indirect block. */
+#define PTRS_PER_SECTOR ((off_t) (BLOCK_SECTOR_SIZE / sizeof (block_sector_t)))
+
+/* Maximum length of an inode in bytes. */
+#define INODE_SPAN ((DIRECT_CNT                                           \
+                     + INDIRECT_CNT * PTRS_PER_SECTOR                     \
+                     + DBL_INDIRECT_CNT * PTRS_PER_SECTOR * PTRS_PER_SECTOR) \
+                    * BLOCK_SECTOR_SIZE)
+
+/* A run of LENGTH sectors starting at PHYSICAL on disk that
+   holds sector indexes LOGICAL...LOGICAL + LENGTH - 1 of a file. */
+struct extent
+  {
+    block_sector_t logical;             /* First sector index in file. */
+    block_sector_t physical;            /* First sector on disk. */
+    block_sector_t length;              /* Number of sectors. */
+  };
+
+/* Number of extents stored in an extent-format inode itself. */
+#define INLINE_EXTENT_CNT 40
+
+/* Number of extents stored in each overflow extent block. */
+#define BLOCK_EXTENT_CNT 42
+
+/* Extent map stored in an extent-format inode.
+   The first INLINE_EXTENT_CNT extents are stored here, the rest
+   in a chain of extent blocks starting at NEXT.  Extents are
+   sorted by logical sector and never overlap. */
+struct extent_map
+  {
+    uint32_t extent_cnt;                /* Total number of extents. */
+    block_sector_t next;                /* First extent block, or 0. */
+    struct extent extents[INLINE_EXTENT_CNT];
+  };
+
+/* Overflow extent block.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    block_sector_t next;                /* Next extent block, or 0. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[BLOCK_EXTENT_CNT];
+  };
+
+/* On-disk inode.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   MAGIC selects one of two ways of mapping file data to disk.
+
+   With INODE_MAGIC, U.SECTORS holds DIRECT_CNT data sectors, then
+   INDIRECT_CNT indirect blocks, each holding PTRS_PER_SECTOR data
+   sectors, then DBL_INDIRECT_CNT doubly indirect blocks, each
+   holding PTRS_PER_SECTOR indirect blocks.  A sector number of 0
+   (which is always the free map inode) marks a block that has
+   not been allocated; it reads as all zeros.
+
+   With EXTENT_MAGIC, U.EXTENTS lists the runs of contiguous
+   sectors that hold the file's data.  Sectors not covered by any
+   extent have not been allocated and read as all zeros. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        block_sector_t sectors[SECTOR_CNT]; /* Data and index sectors. */
+        struct extent_map extents;          /* Extent map. */
+      }
+    u;
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
-
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open inode table. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    block_sector_t alloc_goal;          /* Where to try allocating next. */
+
+    /* Extent-format inodes only: every extent in the inode and
+       its extent blocks, so that lookups need no disk access. */
+    struct extent *extents;             /* Sorted by logical sector. */
+    size_t extent_cnt;                  /* Number of extents. */
+    size_t extent_cap;                  /* Allocated size of EXTENTS. */
   };
 
+/* If true, inode_create() creates extent-format inodes. */
+bool inode_extents;
+
+/* Writes SIZE bytes from BUFFER into metadata SECTOR at offset
+   OFS, as part of the running journal transaction. */
+static void
+meta_write (block_sector_t sector, const void *buffer, off_t ofs, off_t size)
+{
+  cache_write_meta (sector, buffer, ofs, size);
+  journal_add (sector);
+}
+
+/* Returns true if INODE's data is file system metadata, which
+   must be journaled like the inode itself. */
+static bool
+is_meta (const struct inode *inode)
+{
+  return inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Allocates a sector for INODE, preferably just after the one it
+   allocated last, fills it with zeros, and stores its number in
+   *SECTORP.  If META is true, the sector will hold metadata, so
+   the zeros are journaled.  Returns true if successful, false if
+   the disk is full. */
+static bool
+allocate_zeroed (struct inode *inode, bool meta, block_sector_t *sectorp)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate_near (1, inode->alloc_goal, sectorp))
+    return false;
+  inode->alloc_goal = *sectorp + 1;
+  if (meta)
+    meta_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  else
+    cache_zero (*sectorp);
+  return true;
+}
+
+/* Finds the data sector that holds sector index IDX within
+   block-map INODE and stores it in *SECTORP.
+   If the sector, or any index block leading to it, has not been
+   allocated, then: if ALLOCATE is false, stores 0 in *SECTORP;
+   otherwise allocates the missing blocks, filled with zeros.
+   Returns false if IDX is beyond the largest possible inode or
+   if allocation fails, true otherwise. */
+static bool
+map_lookup (struct inode *inode, off_t idx, bool allocate,
+            block_sector_t *sectorp)
+{
+  off_t offsets[3];
+  size_t depth;
+  block_sector_t sector;
+  size_t level;
+
+  /* Compute the path through the index. */
+  if (idx < DIRECT_CNT)
+    {
+      offsets[0] = idx;
+      depth = 1;
+    }
+  else if ((idx -= DIRECT_CNT) < INDIRECT_CNT * PTRS_PER_SECTOR)
+    {
+      offsets[0] = DIRECT_CNT + idx / PTRS_PER_SECTOR;
+      offsets[1] = idx % PTRS_PER_SECTOR;
+      depth = 2;
+    }
+  else if ((idx -= INDIRECT_CNT * PTRS_PER_SECTOR)
+           < DBL_INDIRECT_CNT * PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      offsets[0] = (DIRECT_CNT + INDIRECT_CNT
+                    + idx / (PTRS_PER_SECTOR * PTRS_PER_SECTOR));
+      offsets[1] = idx / PTRS_PER_SECTOR % PTRS_PER_SECTOR;
+      offsets[2] = idx % PTRS_PER_SECTOR;
+      depth = 3;
+    }
+  else
+    return false;
+
+  /* Walk it, allocating as we go if requested. */
+  sector = inode->data.u.sectors[offsets[0]];
+  if (sector == 0)
+    {
+      if (!allocate)
+        goto hole;
+      if (!allocate_zeroed (inode, depth > 1, &sector))
+        return false;
+      inode->data.u.sectors[offsets[0]] = sector;
+      meta_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
+  for (level = 1; level < depth; level++)
+    {
+      off_t ofs = offsets[level] * sizeof (block_sector_t);
+      block_sector_t next;
+
+      cache_read (sector, &next, ofs, sizeof next);
+      if (next == 0)
+        {
+          if (!allocate)
+            goto hole;
+          if (!allocate_zeroed (inode, level + 1 < depth, &next))
+            return false;
+          meta_write (sector, &next, ofs, sizeof next);
+        }
+      sector = next;
+    }
+  *sectorp = sector;
+  return true;
+
+ hole:
+  *sectorp = 0;
+  return true;
+}
+
+/* Returns the index of the first extent in INODE whose logical
+   start is greater than IDX, which is also the position at which
+   an extent starting at IDX would be inserted. */
+static size_t
+extent_search (const struct inode *inode, block_sector_t idx)
+{
+  size_t lo = 0, hi = inode->extent_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (inode->extents[mid].logical <= idx)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Writes INODE's extents numbered FROM and later to disk, along
+   with the inode itself, allocating extent blocks as needed.
+   Returns true if successful, false if an extent block could not
+   be allocated. */
+static bool
+extent_save (struct inode *inode, size_t from)
+{
+  struct extent_map *map = &inode->data.u.extents;
+  block_sector_t prev = 0, block = map->next;
+  size_t base, i;
+
+  /* Overflow extents go in the extent block chain. */
+  for (base = INLINE_EXTENT_CNT; base < inode->extent_cnt;
+       base += BLOCK_EXTENT_CNT)
+    {
+      if (block == 0)
+        {
+          if (!allocate_zeroed (inode, true, &block))
+            return false;
+          if (prev == 0)
+            map->next = block;
+          else
+            meta_write (prev, &block, offsetof (struct extent_block, next),
+                        sizeof block);
+        }
+      if (from < base + BLOCK_EXTENT_CNT)
+        {
+          size_t first = from > base ? from : base;
+          size_t last = (inode->extent_cnt < base + BLOCK_EXTENT_CNT
+                         ? inode->extent_cnt : base + BLOCK_EXTENT_CNT);
+          meta_write (block, &inode->extents[first],
+                      (offsetof (struct extent_block, extents)
+                       + (first - base) * sizeof (struct extent)),
+                      (last - first) * sizeof (struct extent));
+        }
+      prev = block;
+      cache_read (prev, &block, offsetof (struct extent_block, next),
+                  sizeof block);
+    }
+
+  /* The rest, and the count, go in the inode. */
+  for (i = from; i < inode->extent_cnt && i < INLINE_EXTENT_CNT; i++)
+    map->extents[i] = inode->extents[i];
+  map->extent_cnt = inode->extent_cnt;
+  meta_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Reads the extents of extent-format INODE into memory.
+   Returns true if successful, false if memory allocation
+   fails. */
+static bool
+extent_load (struct inode *inode)
+{
+  struct extent_map *map = &inode->data.u.extents;
+  block_sector_t block;
+  size_t i;
+
+  inode->extent_cnt = map->extent_cnt;
+  inode->extent_cap = inode->extent_cnt > 8 ? inode->extent_cnt : 8;
+  inode->extents = malloc (inode->extent_cap * sizeof *inode->extents);
+  if (inode->extents == NULL)
+    return false;
+
+  for (i = 0; i < inode->extent_cnt && i < INLINE_EXTENT_CNT; i++)
+    inode->extents[i] = map->extents[i];
+  for (block = map->next; i < inode->extent_cnt; )
+    {
+      size_t cnt = inode->extent_cnt - i;
+      if (cnt > BLOCK_EXTENT_CNT)
+        cnt = BLOCK_EXTENT_CNT;
+      cache_read (block, &inode->extents[i],
+                  offsetof (struct extent_block, extents),
+                  cnt * sizeof (struct extent));
+      i += cnt;
+      cache_read (block, &block, offsetof (struct extent_block, next),
+                  sizeof block);
+    }
+  return true;
+}
+
+/* Allocates disk space for up to CNT sectors of extent-format
+   INODE starting at sector index IDX, which must not already be
+   mapped, preferring a single contiguous run.  The new sectors
+   are not zeroed, so the caller must write all of them before
+   they can be read.  Returns the number of sectors allocated,
+   which is 0 on failure. */
+static size_t
+extent_allocate (struct inode *inode, block_sector_t idx, size_t cnt)
+{
+  size_t pos = extent_search (inode, idx);
+  struct extent *prev = pos > 0 ? &inode->extents[pos - 1] : NULL;
+  block_sector_t physical;
+
+  /* Don't run into the next extent. */
+  if (pos < inode->extent_cnt && inode->extents[pos].logical - idx < cnt)
+    cnt = inode->extents[pos].logical - idx;
+
+  /* Find the longest contiguous run we can, up to CNT, trying
+     to continue the previous extent on disk. */
+  if (prev != NULL && prev->logical + prev->length == idx)
+    inode->alloc_goal = prev->physical + prev->length;
+  while (!free_map_allocate_near (cnt, inode->alloc_goal, &physical))
+    if ((cnt /= 2) == 0)
+      return 0;
+  inode->alloc_goal = physical + cnt;
+
+  if (prev != NULL
+      && prev->logical + prev->length == idx
+      && prev->physical + prev->length == physical)
+    {
+      /* Extend the previous extent. */
+      prev->length += cnt;
+      if (extent_save (inode, pos - 1))
+        return cnt;
+      prev->length -= cnt;
+    }
+  else
+    {
+      /* Insert a new extent. */
+      if (inode->extent_cnt >= inode->extent_cap)
+        {
+          size_t new_cap = inode->extent_cap * 2;
+          struct extent *new_extents
+            = realloc (inode->extents, new_cap * sizeof *new_extents);
+          if (new_extents == NULL)
+            goto fail;
+          inode->extents = new_extents;
+          inode->extent_cap = new_cap;
+        }
+      memmove (&inode->extents[pos + 1], &inode->extents[pos],
+               (inode->extent_cnt - pos) * sizeof *inode->extents);
+      inode->extents[pos].logical = idx;
+      inode->extents[pos].physical = physical;
+      inode->extents[pos].length = cnt;
+      inode->extent_cnt++;
+      if (extent_save (inode, pos))
+        return cnt;
+      inode->extent_cnt--;
+      memmove (&inode->extents[pos], &inode->extents[pos + 1],
+               (inode->extent_cnt - pos) * sizeof *inode->extents);
+    }
+
+ fail:
+  free_map_release (physical, cnt);
+  free_map_flush ();
+  return 0;
+}
+
+/* Finds the data sector that holds sector index IDX within
+   extent-format INODE and stores it in *SECTORP.
+   If the sector has not been allocated, then: if ALLOCATE is
+   false, stores 0 in *SECTORP; otherwise allocates up to
+   RUN_CNT sectors starting at IDX, which are not zeroed, and
+   stores the number allocated in *NEW_CNTP.
+   Returns false if allocation fails, true otherwise. */
+static bool
+extent_lookup (struct inode *inode, block_sector_t idx, bool allocate,
+               size_t run_cnt, block_sector_t *sectorp, size_t *new_cntp)
+{
+  size_t pos = extent_search (inode, idx);
+  size_t new_cnt;
+
+  *new_cntp = 0;
+
+  if (pos > 0)
+    {
+      const struct extent *e = &inode->extents[pos - 1];
+      if (idx - e->logical < e->length)
+        {
+          *sectorp = e->physical + (idx - e->logical);
+          return true;
+        }
+    }
+
+  if (!allocate)
+    {
+      *sectorp = 0;
+      return true;
+    }
+  new_cnt = extent_allocate (inode, idx, run_cnt);
+  if (new_cnt == 0)
+    return false;
+  extent_lookup (inode, idx, false, 0, sectorp, new_cntp);
+  *new_cntp = new_cnt;
+  return true;
+}
+
+/* Finds the data sector that holds sector index IDX within
+   INODE and stores it in *SECTORP, as described for map_lookup().
+   For an extent-format inode, an allocation covers up to RUN_CNT
+   sectors starting at IDX, in anticipation of further writes.
+   If NEW_CNTP is nonnull, stores in it the number of sectors,
+   starting at *SECTORP, that this call allocated without zeroing
+   them. */
+static bool
+lookup_sector (struct inode *inode, off_t idx, bool allocate,
+               size_t run_cnt, block_sector_t *sectorp, size_t *new_cntp)
+{
+  size_t new_cnt = 0;
+  bool success;
+
+  if (inode->data.magic == EXTENT_MAGIC)
+    success = extent_lookup (inode, idx, allocate, run_cnt, sectorp,
+                             &new_cnt);
+  else
+    success = map_lookup (inode, idx, allocate, sectorp);
+  if (new_cntp != NULL)
+    *new_cntp = new_cnt;
+  return success;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or 0 if that part of INODE has not been
+   allocated.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  block_sector_t sector;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  if (pos < inode->data.length
+      && lookup_sector (inode, pos / BLOCK_SECTOR_SIZE, false, 0, &sector,
+                        NULL))
+    return sector;
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Returns the number of sectors, up to MAX, that hold INODE's
+   data starting at the sector containing byte offset POS and lie
+   consecutively on disk, and stores the first in *SECTORP.
+   Returns 0 if that sector is unallocated or past end of file. */
+static size_t
+contiguous_run (struct inode *inode, off_t pos, size_t max,
+                block_sector_t *sectorp)
+{
+  block_sector_t first = byte_to_sector (inode, pos);
+  size_t cnt;
+
+  if (first == 0 || first == (block_sector_t) -1)
+    return 0;
+  pos -= pos % BLOCK_SECTOR_SIZE;
+  for (cnt = 1; cnt < max; cnt++)
+    if (byte_to_sector (inode, pos + cnt * BLOCK_SECTOR_SIZE) != first + cnt)
+      break;
+  *sectorp = first;
+  return cnt;
+}
+
+/* A run of consecutive sectors waiting to be released, so that
+   the free map is updated once per run instead of once per
+   sector. */
+struct release_run
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* Releases the sectors in RUN and empties it.  Deleting a large
+   file releases many runs, so the journal may commit after each
+   one: the inode is already unreachable, so a crash here only
+   leaks the sectors not yet released. */
+static void
+release_flush (struct release_run *run)
+{
+  if (run->cnt > 0)
+    {
+      free_map_release (run->start, run->cnt);
+      run->cnt = 0;
+      journal_yield ();
+    }
+}
+
+/* Adds the CNT sectors starting at SECTOR to RUN, first
+   releasing RUN's sectors if the new ones do not follow them. */
+static void
+release_add (struct release_run *run, block_sector_t sector, size_t cnt)
+{
+  if (run->cnt > 0 && run->start + run->cnt == sector)
+    run->cnt += cnt;
+  else
+    {
+      release_flush (run);
+      run->start = sector;
+      run->cnt = cnt;
+    }
+}
+
+/* Adds SECTOR, which is an index block LEVEL levels above the
+   data (0 for a data sector), along with every block it refers
+   to, to RUN. */
+static void
+release_tree (struct release_run *run, block_sector_t sector, int level)
+{
+  if (sector == 0)
+    return;
+  if (level > 0)
+    {
+      off_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t child;
+          cache_read (sector, &child, i * sizeof child, sizeof child);
+          release_tree (run, child, level - 1);
+        }
+    }
+  release_add (run, sector, 1);
+}
+
+/* Releases every data, index, and extent block allocated to
+   INODE. */
+static void
+release_sectors (struct inode *inode)
+{
+  struct release_run run;
+
+  run.cnt = 0;
+  if (inode->data.magic == EXTENT_MAGIC)
+    {
+      block_sector_t block = inode->data.u.extents.next;
+      size_t i;
+
+      for (i = 0; i < inode->extent_cnt; i++)
+        release_add (&run, inode->extents[i].physical,
+                     inode->extents[i].length);
+      while (block != 0)
+        {
+          block_sector_t next;
+          cache_read (block, &next, offsetof (struct extent_block, next),
+                      sizeof next);
+          release_add (&run, block, 1);
+          block = next;
+        }
+    }
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < SECTOR_CNT; i++)
+        release_tree (&run, inode->data.u.sectors[i],
+                      (i < DIRECT_CNT ? 0
+                       : i < DIRECT_CNT + INDIRECT_CNT ? 1 : 2));
+    }
+  release_flush (&run);
+}
+
+/* Number of open inode tables.
+   An inode goes in the table selected by its sector number modulo
+   this value, so that opens and closes of unrelated inodes rarely
+   contend for the same lock. */
+#define OPEN_TABLE_CNT 8
+
+/* Table of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+struct open_table
+  {
+    struct lock lock;                   /* Protects the following. */
+    struct hash inodes;                 /* Open inodes, keyed by sector. */
+    unsigned long long open_cnt;        /* Number of inode_open() calls. */
+    unsigned long long miss_cnt;        /* Opens that read the disk. */
+  };
+
+static struct open_table open_tables[OPEN_TABLE_CNT];
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Returns the open inode table for SECTOR. */
+static struct open_table *
+open_table_for (block_sector_t sector)
+{
+  return &open_tables[sector % OPEN_TABLE_CNT];
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  size_t i;
+
+  for (i = 0; i < OPEN_TABLE_CNT; i++)
+    {
+      struct open_table *t = &open_tables[i];
+      lock_init (&t->lock);
+      hash_init (&t->inodes, inode_hash, inode_less, NULL);
+      t->open_cnt = t->miss_cnt = 0;
+    }
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is marked as a directory if IS_DIR is true.
+   The data initially reads as all zeros.
+   The inode uses the extent format if inode_extents is true,
+   otherwise the block-map format.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too
+   large. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
 
   ASSERT (length >= 0);
 
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
+
+  if (!inode_extents && length > INODE_SPAN)
+    return false;
 
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
-  return success;
+  if (disk_inode == NULL)
+    return false;
+
+  /* Data sectors are allocated lazily, as they are written. */
+  disk_inode->length = length;
+  disk_inode->magic = inode_extents ? EXTENT_MAGIC : INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  journal_begin ();
+  meta_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+  journal_end ();
+  free (disk_inode);
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -111,33 +686,50 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct open_table *t = open_table_for (sector);
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&t->lock);
+  t->open_cnt++;
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&t->inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&t->lock);
+      return inode;
     }
+  t->miss_cnt++;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&t->lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->alloc_goal = sector + 1;
+  inode->extents = NULL;
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  if (inode->data.magic == EXTENT_MAGIC && !extent_load (inode))
+    {
+      lock_release (&t->lock);
+      free (inode);
+      return NULL;
+    }
+  hash_insert (&t->inodes, &inode->elem);
+  lock_release (&t->lock);
   return inode;
 }
 
@@ -146,7 +738,12 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      struct open_table *t = open_table_for (inode->sector);
+      lock_acquire (&t->lock);
+      inode->open_cnt++;
+      lock_release (&t->lock);
+    }
   return inode;
 }
 
@@ -163,24 +760,34 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  struct open_table *t;
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  t = open_table_for (inode->sector);
+  lock_acquire (&t->lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&t->inodes, &inode->elem);
+  lock_release (&t->lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          journal_begin ();
+          release_sectors (inode);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          free_map_flush ();
+          journal_end ();
         }
 
+      free (inode->extents);
       free (inode); 
     }
 }
@@ -194,6 +801,20 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been marked for deletion. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,7 +823,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t prefetched = 0;         /* End of sectors already prefetched. */
 
   while (size > 0) 
     {
@@ -210,6 +831,25 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
+      /* When the read goes on past this sector, bring the
+         sectors it covers into the cache ahead of time, so that
+         a run of them on disk takes one request instead of one
+         per sector. */
+      if (offset >= prefetched && sector_ofs + size > BLOCK_SECTOR_SIZE)
+        {
+          size_t want = DIV_ROUND_UP (sector_ofs + size, BLOCK_SECTOR_SIZE);
+          block_sector_t first;
+          size_t cnt;
+
+          if (want > CACHE_RUN_MAX)
+            want = CACHE_RUN_MAX;
+          cnt = contiguous_run (inode, offset, want, &first);
+          if (cnt > 1)
+            cache_prefetch (first, cnt);
+          prefetched = (offset - sector_ofs
+                        + (cnt > 0 ? cnt : 1) * BLOCK_SECTOR_SIZE);
+        }
+
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
@@ -220,99 +860,103 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != 0)
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* Start fetching the sector after the last one we read, on the
+     guess that the caller is reading sequentially. */
+  if (bytes_read > 0 && offset % BLOCK_SECTOR_SIZE == 0
+      && offset < inode_length (inode))
+    {
+      block_sector_t next;
+      size_t cnt = contiguous_run (inode, offset, CACHE_RUN_MAX, &next);
+      if (cnt > 0)
+        cache_readahead (next, cnt);
+    }
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the write would exceed
+   the maximum inode size.
+   Writing past end of file extends the inode.  Any gap between
+   the old end of file and OFFSET reads as zeros and is not
+   allocated until it is written. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+
+  /* Sectors allocated by this write and not yet written. */
+  block_sector_t fresh_start = 0;
+  size_t fresh_cnt = 0;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  journal_begin ();
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector, bytes to write into it. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int chunk_size = size < sector_left ? size : sector_left;
+      size_t new_cnt;
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      if (!lookup_sector (inode, offset / BLOCK_SECTOR_SIZE, true,
+                          DIV_ROUND_UP (sector_ofs + size, BLOCK_SECTOR_SIZE),
+                          &sector_idx, &new_cnt))
         break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (new_cnt > 0)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          fresh_start = sector_idx;
+          fresh_cnt = new_cnt;
         }
 
+      /* A new run holds stale data.  The sectors in its middle
+         are overwritten whole, so only a partly written first or
+         last sector needs zeroing first. */
+      if (chunk_size < BLOCK_SECTOR_SIZE
+          && sector_idx - fresh_start < fresh_cnt)
+        cache_zero (sector_idx);
+      if (is_meta (inode))
+        meta_write (sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+      else
+        cache_write (sector_idx, buffer + bytes_written,
+                     sector_ofs, chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
+
+      /* Every sector written so far is reachable from the inode,
+         so a long write may commit here. */
+      journal_yield ();
+    }
+
+  /* Extend the file if we wrote past its end. */
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      meta_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
     }
-  free (bounce);
+  journal_end ();
 
   return bytes_written;
 }
@@ -343,3 +987,42 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Prints open inode statistics. */
+void
+inode_print_stats (void)
+{
+  size_t inode_cnt = 0;
+  unsigned long long open_cnt = 0, miss_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < OPEN_TABLE_CNT; i++)
+    {
+      struct open_table *t = &open_tables[i];
+      lock_acquire (&t->lock);
+      inode_cnt += hash_size (&t->inodes);
+      open_cnt += t->open_cnt;
+      miss_cnt += t->miss_cnt;
+      lock_release (&t->lock);
+    }
+  printf ("Inodes: %zu open, %llu opens, %llu read from disk\n",
+          inode_cnt, open_cnt, miss_cnt);
+}
+
+/* Returns a hash value for the sector of open inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if open inode A precedes open inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
+}
@@ -0,0 +1,389 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata journal.
+
+   Every change to file system metadata (inodes, index and extent
+   blocks, directories, and the free map) is written with
+   cache_write_meta() and recorded with journal_add() as part of
+   the running transaction.  The buffer cache holds such sectors
+   until the transaction commits, so their home locations on disk
+   never reflect an uncommitted change.
+
+   File system operations bracket their updates with
+   journal_begin() and journal_end(), which may nest.  A commit
+   waits until no operation is in progress, so a transaction
+   always covers whole operations.  Commits happen every
+   COMMIT_MS milliseconds from a kernel thread, grouping all the
+   operations in that interval into one sequential journal write,
+   and sooner if the running transaction grows large.
+
+   On disk, the journal is JOURNAL_SECTORS sectors starting at
+   JOURNAL_SECTOR.  The first holds a superblock with the sequence
+   number of the first transaction.  Transactions follow, each a
+   descriptor listing the home sectors, a copy of each sector,
+   and a commit record.  Recovery copies each complete transaction
+   to its home location, in order, stopping at the first missing
+   or incomplete one.
+
+   When the journal fills up, or a committed transaction freed a
+   sector that the journal holds a copy of, the journal is
+   checkpointed: every cached sector is written home and the
+   journal is emptied.  The latter keeps recovery from copying an
+   old metadata block over a sector that was later reused. */
+
+/* Magic numbers. */
+#define SUPER_MAGIC 0x4a524e4c          /* Superblock. */
+#define DESC_MAGIC 0x4a445343           /* Descriptor. */
+#define COMMIT_MAGIC 0x4a434d54         /* Commit record. */
+
+/* Maximum sectors in a transaction. */
+#define TXN_MAX 96
+
+/* journal_begin() and journal_yield() force a commit once a
+   transaction has this many sectors.  Sectors in the running
+   transaction stay pinned in the cache, so this must be well
+   below CACHE_CNT, as well as leave room under TXN_MAX for the
+   operations already in progress. */
+#define TXN_SOFT_MAX (CACHE_CNT / 4 < TXN_MAX / 4 ? CACHE_CNT / 4 : TXN_MAX / 4)
+
+/* Interval between group commits, in milliseconds. */
+#define COMMIT_MS 50
+
+/* Superblock, descriptor, or commit record.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    uint32_t magic;                     /* One of the magic numbers. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Number of sectors. */
+    block_sector_t sectors[125];        /* Home sectors (descriptor). */
+  };
+
+/* Running transaction and commit state. */
+static struct lock journal_lock;        /* Protects the following. */
+static struct condition journal_cond;   /* Signaled on state changes. */
+static int active_cnt;                  /* Operations in progress. */
+static bool committing;                 /* Commit in progress? */
+static block_sector_t txn[TXN_MAX];     /* Sectors in running transaction. */
+static size_t txn_cnt;                  /* Number of sectors in TXN. */
+static bool need_checkpoint;            /* Logged sector was freed? */
+
+/* Sectors with a copy in the journal or the running transaction. */
+static struct bitmap *logged;
+
+/* On-disk journal position, protected by commit_lock. */
+static struct lock commit_lock;         /* Serializes commits. */
+static uint32_t next_seq;               /* Sequence number of next commit. */
+static block_sector_t head;             /* Next free journal sector. */
+
+/* Buffers for journal I/O, protected by commit_lock. */
+static struct journal_header header;
+static struct journal_header commit;
+static uint8_t images[TXN_MAX][BLOCK_SECTOR_SIZE];
+
+static void journal_reset (void);
+static void journal_replay (void);
+static thread_func commit_daemon NO_RETURN;
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal; otherwise, recovers any transactions committed before
+   the last shutdown or crash.  Must be called before any other
+   file system access. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+
+  if (block_size (fs_device) < JOURNAL_SECTOR + JOURNAL_SECTORS)
+    PANIC ("file system device too small for journal");
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  lock_init (&commit_lock);
+  logged = bitmap_create (block_size (fs_device));
+  if (logged == NULL)
+    PANIC ("journal bitmap creation failed");
+
+  if (format)
+    {
+      next_seq = 1;
+      journal_reset ();
+    }
+  else
+    journal_replay ();
+
+  thread_create ("journal", PRI_DEFAULT, commit_daemon, NULL);
+}
+
+/* Commits the running transaction and checkpoints the journal,
+   so that every change is in its home location. */
+void
+journal_done (void)
+{
+  lock_acquire (&journal_lock);
+  need_checkpoint = true;
+  lock_release (&journal_lock);
+  journal_commit ();
+}
+
+/* Begins a file system operation, so that no commit happens until
+   the matching journal_end().  Calls may nest. */
+void
+journal_begin (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->journal_depth++ > 0)
+    return;
+
+  if (txn_cnt >= TXN_SOFT_MAX)
+    journal_commit ();
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_cond, &journal_lock);
+  active_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends a file system operation begun with journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->journal_depth > 0);
+  if (--cur->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--active_cnt == 0)
+    cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Lets the running transaction commit partway through the
+   current thread's operation, if the transaction has grown
+   large.  Operations that touch an unbounded number of sectors,
+   such as writing or deleting a large file, call this between
+   steps.  The caller must leave the file system consistent at
+   this point, since a crash may preserve the steps so far without
+   the rest; leaking sectors is acceptable, losing them is not.
+
+   Does nothing inside a nested operation, whose caller may still
+   have changes to make that must commit along with the ones so
+   far.  Nested operations must therefore touch only a bounded
+   number of sectors. */
+void
+journal_yield (void)
+{
+  if (thread_current ()->journal_depth != 1 || txn_cnt < TXN_SOFT_MAX)
+    return;
+
+  journal_end ();
+  journal_begin ();
+}
+
+/* Adds SECTOR, just written with cache_write_meta(), to the
+   running transaction. */
+void
+journal_add (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < txn_cnt; i++)
+    if (txn[i] == sector)
+      break;
+  if (i == txn_cnt)
+    {
+      if (txn_cnt >= TXN_MAX)
+        PANIC ("journal transaction too large");
+      txn[txn_cnt++] = sector;
+      bitmap_mark (logged, sector);
+    }
+  lock_release (&journal_lock);
+}
+
+/* Notes that CNT sectors starting at SECTOR have been freed.  If
+   the journal holds a copy of any of them, it will be
+   checkpointed after the next commit. */
+void
+journal_release (block_sector_t sector, size_t cnt)
+{
+  if (logged == NULL)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (bitmap_any (logged, sector, cnt))
+    need_checkpoint = true;
+  lock_release (&journal_lock);
+}
+
+/* Writes the running transaction to the journal, then releases
+   its sectors to be written home. */
+static void
+write_transaction (void)
+{
+  struct block_iovec iov[3];
+  size_t i;
+
+  if (txn_cnt == 0)
+    return;
+  ASSERT (txn_cnt <= sizeof header.sectors / sizeof *header.sectors);
+
+  /* journal_commit() always leaves room for a full transaction. */
+  ASSERT (head + txn_cnt + 2 <= JOURNAL_SECTOR + JOURNAL_SECTORS);
+
+  /* Descriptor. */
+  memset (&header, 0, sizeof header);
+  header.magic = DESC_MAGIC;
+  header.seq = next_seq;
+  header.cnt = txn_cnt;
+  memcpy (header.sectors, txn, txn_cnt * sizeof *txn);
+
+  /* Sector images. */
+  for (i = 0; i < txn_cnt; i++)
+    cache_read (txn[i], images[i], 0, BLOCK_SECTOR_SIZE);
+
+  /* Commit record.  Once it is on disk, the transaction is
+     durable. */
+  memset (&commit, 0, sizeof commit);
+  commit.magic = COMMIT_MAGIC;
+  commit.seq = next_seq;
+  commit.cnt = txn_cnt;
+
+  /* Write all three in a single request.  The commit record goes
+     last, so a crash partway through leaves the transaction
+     incomplete, not corrupt. */
+  iov[0].base = &header;
+  iov[0].size = BLOCK_SECTOR_SIZE;
+  iov[1].base = images;
+  iov[1].size = txn_cnt * BLOCK_SECTOR_SIZE;
+  iov[2].base = &commit;
+  iov[2].size = BLOCK_SECTOR_SIZE;
+  block_write_multi (fs_device, head, txn_cnt + 2, iov, 3);
+
+  head += txn_cnt + 2;
+  next_seq++;
+
+  for (i = 0; i < txn_cnt; i++)
+    cache_release_meta (txn[i]);
+  txn_cnt = 0;
+}
+
+/* Commits the running transaction, waiting for operations in
+   progress to finish and holding off new ones until done. */
+void
+journal_commit (void)
+{
+  lock_acquire (&commit_lock);
+
+  lock_acquire (&journal_lock);
+  committing = true;
+  while (active_cnt > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  write_transaction ();
+  if (need_checkpoint || head + TXN_MAX + 2 > JOURNAL_SECTOR + JOURNAL_SECTORS)
+    {
+      cache_flush ();
+      journal_reset ();
+    }
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  lock_release (&commit_lock);
+}
+
+/* Empties the journal by writing a superblock whose sequence
+   number matches no transaction on disk.  Every sector that the
+   journal held must already be in its home location, and the
+   running transaction must be empty. */
+static void
+journal_reset (void)
+{
+  ASSERT (txn_cnt == 0);
+
+  memset (&header, 0, sizeof header);
+  header.magic = SUPER_MAGIC;
+  header.seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+  head = JOURNAL_SECTOR + 1;
+
+  bitmap_set_all (logged, false);
+  need_checkpoint = false;
+}
+
+/* Copies every complete transaction in the journal to its home
+   location, then empties the journal. */
+static void
+journal_replay (void)
+{
+  block_sector_t end = JOURNAL_SECTOR + JOURNAL_SECTORS;
+  block_sector_t pos = JOURNAL_SECTOR + 1;
+  size_t replayed = 0;
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != SUPER_MAGIC)
+    PANIC ("file system has no journal (reformat with -f)");
+  next_seq = header.seq;
+
+  for (;;)
+    {
+      struct block_iovec iov[2];
+      size_t cnt, i;
+
+      /* Read and check descriptor and commit record. */
+      if (pos + 2 > end)
+        break;
+      block_read (fs_device, pos, &header);
+      cnt = header.cnt;
+      if (header.magic != DESC_MAGIC || header.seq != next_seq
+          || cnt == 0 || cnt > TXN_MAX || pos + cnt + 2 > end)
+        break;
+      iov[0].base = images;
+      iov[0].size = cnt * BLOCK_SECTOR_SIZE;
+      iov[1].base = &commit;
+      iov[1].size = BLOCK_SECTOR_SIZE;
+      block_read_multi (fs_device, pos + 1, cnt + 1, iov, 2);
+      if (commit.magic != COMMIT_MAGIC || commit.seq != next_seq)
+        break;
+
+      /* Copy sectors home. */
+      for (i = 0; i < cnt; i++)
+        block_write (fs_device, header.sectors[i], images[i]);
+
+      pos += cnt + 2;
+      next_seq++;
+      replayed++;
+    }
+
+  if (replayed > 0)
+    printf ("journal: replayed %zu transaction(s)\n", replayed);
+  journal_reset ();
+}
+
+/* Commits the running transaction every COMMIT_MS milliseconds. */
+static void
+commit_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_msleep (COMMIT_MS);
+      journal_commit ();
+    }
+}
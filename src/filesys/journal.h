@@ -0,0 +1,21 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Location of the journal on the file system device. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal. */
+#define JOURNAL_SECTORS 128     /* Sectors in the journal. */
+
+void journal_init (bool format);
+void journal_done (void);
+void journal_begin (void);
+void journal_end (void);
+void journal_yield (void);
+void journal_add (block_sector_t);
+void journal_release (block_sector_t, size_t cnt);
+void journal_commit (void);
+
+#endif /* filesys/journal.h */
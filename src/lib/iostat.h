@@ -0,0 +1,29 @@
+#ifndef __LIB_IOSTAT_H
+#define __LIB_IOSTAT_H
+
+/* Number of buckets in a latency histogram.  Bucket 0 counts
+   requests that took fewer than 2 TSC cycles; bucket I, for I >
+   0, those that took 2**I to 2**(I+1) - 1 cycles; and the last
+   bucket, all longer requests. */
+#define IOSTAT_HIST_CNT 40
+
+/* Block I/O statistics, as reported by the iostat() system call
+   for a block device or the calling process.  Only the byte and
+   request counts apply to a process. */
+struct iostat
+  {
+    unsigned long long read_bytes;      /* Bytes read. */
+    unsigned long long write_bytes;     /* Bytes written. */
+    unsigned long long read_reqs;       /* Read requests. */
+    unsigned long long write_reqs;      /* Write requests. */
+
+    unsigned int depth;                 /* Requests now in progress. */
+    unsigned int max_depth;             /* Most requests in progress. */
+    unsigned long long depth_sum;       /* Sum of depth at each arrival. */
+
+    /* Requests by latency, from submission to completion. */
+    unsigned long long read_latency[IOSTAT_HIST_CNT];
+    unsigned long long write_latency[IOSTAT_HIST_CNT];
+  };
+
+#endif /* lib/iostat.h */
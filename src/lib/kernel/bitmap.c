@@ -359,6 +359,29 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the CNT bits of B starting at START to FILE, in the
+   same place within FILE as bitmap_write() would, without
+   rewriting the rest.  Relies on the little-endian layout of
+   elem_type, which puts bit K in byte K / CHAR_BIT.  Returns true
+   if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t first, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  first = start / CHAR_BIT;
+  size = (start + cnt - 1) / CHAR_BIT + 1 - first;
+  return file_write_at (file, (const uint8_t *) b->bits + first,
+                        size, first) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
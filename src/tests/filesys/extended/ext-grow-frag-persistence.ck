@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($contents) = "\0" x (99 * 1024 + 1);
+substr ($contents, $_ * 1024, 1) = 'x' foreach 0...99;
+substr ($contents, $_ * 1024 + 512, 1) = 'y' foreach 0...98;
+check_archive ({"testfile" => [$contents]});
+pass;
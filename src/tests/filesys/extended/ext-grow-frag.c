@@ -0,0 +1,49 @@
+/* Writes a byte into every other sector of a file, with extent-
+   based inodes, so that each lands in an extent of its own and
+   the extents overflow the inode into a chain of extent blocks.
+   Then fills in the sectors in between, which inserts extents in
+   the middle of the chain, and checks the contents. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Number of sectors written in the first pass, which is more
+   than the inode and one extent block hold. */
+#define SECTOR_CNT 100
+#define FILE_SIZE ((SECTOR_CNT - 1) * 1024 + 1)
+
+static char buf[FILE_SIZE];
+
+/* Writes CH at offset OFS in file FD. */
+static void
+write_byte (int fd, int ofs, char ch)
+{
+  seek (fd, ofs);
+  if (write (fd, &ch, 1) != 1)
+    fail ("write at offset %d failed", ofs);
+  buf[ofs] = ch;
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+  int i;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  msg ("write every other sector");
+  for (i = 0; i < SECTOR_CNT; i++)
+    write_byte (fd, i * 1024, 'x');
+
+  msg ("fill in the sectors between");
+  for (i = 0; i < SECTOR_CNT - 1; i++)
+    write_byte (fd, i * 1024 + 512, 'y');
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(ext-grow-frag) begin
+(ext-grow-frag) create "testfile"
+(ext-grow-frag) open "testfile"
+(ext-grow-frag) write every other sector
+(ext-grow-frag) fill in the sectors between
+(ext-grow-frag) close "testfile"
+(ext-grow-frag) open "testfile" for verification
+(ext-grow-frag) verified contents of "testfile"
+(ext-grow-frag) close "testfile"
+(ext-grow-frag) end
+EOF
+pass;
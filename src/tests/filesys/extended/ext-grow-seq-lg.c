@@ -0,0 +1,7 @@
+/* grow-seq-lg, run with extent-based inodes: each 1,234-byte
+   write starts and ends partway through a sector, so the parts of
+   newly allocated sectors that it does not cover must be
+   zeroed. */
+
+#define TEST_SIZE 72943
+#include "tests/filesys/extended/grow-seq.inc"
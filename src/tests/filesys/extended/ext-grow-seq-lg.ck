@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(ext-grow-seq-lg) begin
+(ext-grow-seq-lg) create "testme"
+(ext-grow-seq-lg) open "testme"
+(ext-grow-seq-lg) writing "testme"
+(ext-grow-seq-lg) close "testme"
+(ext-grow-seq-lg) open "testme" for verification
+(ext-grow-seq-lg) verified contents of "testme"
+(ext-grow-seq-lg) close "testme"
+(ext-grow-seq-lg) end
+EOF
+pass;
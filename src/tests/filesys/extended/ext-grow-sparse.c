@@ -0,0 +1,5 @@
+/* grow-sparse, run with extent-based inodes: the region skipped
+   over must read back as zeros even though the run allocated for
+   the write is not zeroed in advance. */
+
+#include "tests/filesys/extended/grow-sparse.c"
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(ext-grow-sparse) begin
+(ext-grow-sparse) create "testfile"
+(ext-grow-sparse) open "testfile"
+(ext-grow-sparse) seek "testfile"
+(ext-grow-sparse) write "testfile"
+(ext-grow-sparse) close "testfile"
+(ext-grow-sparse) open "testfile" for verification
+(ext-grow-sparse) verified contents of "testfile"
+(ext-grow-sparse) close "testfile"
+(ext-grow-sparse) end
+EOF
+pass;
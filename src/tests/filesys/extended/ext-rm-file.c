@@ -0,0 +1,38 @@
+/* Creates, fills, and removes a 1 MB file with extent-based
+   inodes, several times over on a 2 MB disk, which can only
+   succeed if removing the file gives all of its space back. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK_SIZE 65536
+#define CHUNK_CNT 16
+#define ROUND_CNT 4
+
+static char buf[CHUNK_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int round;
+
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      int fd;
+      int i;
+
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      msg ("write \"%s\"", file_name);
+      for (i = 0; i < CHUNK_CNT; i++)
+        if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+          fail ("write %d of round %d failed", i, round);
+      CHECK (filesize (fd) == CHUNK_SIZE * CHUNK_CNT,
+             "filesize \"%s\"", file_name);
+      msg ("close \"%s\"", file_name);
+      close (fd);
+      CHECK (remove (file_name), "remove \"%s\"", file_name);
+    }
+}
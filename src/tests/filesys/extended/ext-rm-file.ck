@@ -0,0 +1,33 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(ext-rm-file) begin
+(ext-rm-file) create "testfile"
+(ext-rm-file) open "testfile"
+(ext-rm-file) write "testfile"
+(ext-rm-file) filesize "testfile"
+(ext-rm-file) close "testfile"
+(ext-rm-file) remove "testfile"
+(ext-rm-file) create "testfile"
+(ext-rm-file) open "testfile"
+(ext-rm-file) write "testfile"
+(ext-rm-file) filesize "testfile"
+(ext-rm-file) close "testfile"
+(ext-rm-file) remove "testfile"
+(ext-rm-file) create "testfile"
+(ext-rm-file) open "testfile"
+(ext-rm-file) write "testfile"
+(ext-rm-file) filesize "testfile"
+(ext-rm-file) close "testfile"
+(ext-rm-file) remove "testfile"
+(ext-rm-file) create "testfile"
+(ext-rm-file) open "testfile"
+(ext-rm-file) write "testfile"
+(ext-rm-file) filesize "testfile"
+(ext-rm-file) close "testfile"
+(ext-rm-file) remove "testfile"
+(ext-rm-file) end
+EOF
+pass;
@@ -0,0 +1,79 @@
+/* Checks that timer_sleep_until() wakes threads on exactly the
+   requested tick, including deadlines far enough away that the
+   sleeping thread must be cascaded between timing wheel levels
+   before it wakes up. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Wake-up deadlines, in ticks after the start of the test. */
+static const int deadlines[] = {700, 5, 300, 256, 1};
+#define SLEEPER_CNT (sizeof deadlines / sizeof *deadlines)
+
+/* Information about one sleeping thread. */
+struct sleeper 
+  {
+    int64_t wake_tick;          /* Requested wake-up tick. */
+    int64_t woke_tick;          /* Tick at which it actually woke. */
+    struct semaphore done;      /* Upped after waking. */
+  };
+
+static thread_func sleeper;
+
+void
+test_alarm_until (void) 
+{
+  struct sleeper sleepers[SLEEPER_CNT];
+  int64_t start;
+  size_t i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Start at the beginning of a timer tick. */
+  timer_sleep (1);
+  start = timer_ticks () + 10;
+
+  for (i = 0; i < SLEEPER_CNT; i++) 
+    {
+      struct sleeper *s = &sleepers[i];
+      char name[16];
+
+      s->wake_tick = start + deadlines[i];
+      sema_init (&s->done, 0);
+      snprintf (name, sizeof name, "sleeper %zu", i);
+      thread_create (name, PRI_MAX, sleeper, s);
+    }
+
+  for (i = 0; i < SLEEPER_CNT; i++) 
+    {
+      struct sleeper *s = &sleepers[i];
+
+      sema_down (&s->done);
+      if (s->woke_tick == s->wake_tick)
+        msg ("sleeper %zu woke on time", i);
+      else
+        msg ("sleeper %zu woke at %"PRId64" ticks, expected %"PRId64,
+             i, s->woke_tick - start, s->wake_tick - start);
+    }
+
+  /* A deadline in the past returns immediately. */
+  timer_sleep_until (start);
+  msg ("past deadline returned");
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *s_) 
+{
+  struct sleeper *s = s_;
+
+  timer_sleep_until (s->wake_tick);
+  s->woke_tick = timer_ticks ();
+  sema_up (&s->done);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-until) begin
+(alarm-until) sleeper 0 woke on time
+(alarm-until) sleeper 1 woke on time
+(alarm-until) sleeper 2 woke on time
+(alarm-until) sleeper 3 woke on time
+(alarm-until) sleeper 4 woke on time
+(alarm-until) past deadline returned
+(alarm-until) end
+EOF
+pass;
@@ -0,0 +1,15 @@
+/* Passes a bad pointer for the statistics to the iostat system
+   call, which must cause the process to be terminated with exit
+   code -1. */
+
+#include <iostat.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  msg ("iostat(0x20101234): %d",
+       iostat (NULL, (struct iostat *) 0x20101234));
+}
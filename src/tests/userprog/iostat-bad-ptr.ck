@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(iostat-bad-ptr) begin
+iostat-bad-ptr: exit(-1)
+EOF
+pass;
@@ -0,0 +1,57 @@
+/* Exercises the iostat system call.  A null device name reports
+   the calling process's own I/O, which must account for a cold
+   read of a file once, neither more nor less.  A known device
+   name must succeed and an unknown one must fail. */
+
+#include <iostat.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Four times the size of the buffer cache, so that once the file
+   has been written, at least its first three quarters must be
+   read back from disk. */
+#define FILE_SIZE 131072
+
+/* Room for reading index blocks, and for paging in code, on top
+   of the file's data. */
+#define SLACK 16384
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  struct iostat before, after, dev;
+  unsigned long long read_bytes;
+  int handle;
+  int ofs;
+
+  CHECK (create ("big", 0), "create \"big\"");
+  CHECK ((handle = open ("big")) > 1, "open \"big\"");
+  CHECK (write (handle, buf, FILE_SIZE) == FILE_SIZE, "write \"big\"");
+
+  /* Read the file back a page at a time from the end, so that
+     read-ahead, which fetches the sectors after each read, never
+     does the reading on our behalf. */
+  CHECK (iostat (NULL, &before), "iostat process");
+  msg ("read \"big\" backward");
+  for (ofs = FILE_SIZE - 4096; ofs >= 0; ofs -= 4096)
+    {
+      seek (handle, ofs);
+      if (read (handle, buf + ofs, 4096) != 4096)
+        fail ("read \"big\" at offset %d failed", ofs);
+    }
+  CHECK (iostat (NULL, &after), "iostat process again");
+
+  read_bytes = after.read_bytes - before.read_bytes;
+  if (read_bytes < FILE_SIZE / 2 || read_bytes > FILE_SIZE + SLACK)
+    fail ("process read %llu bytes for a %d-byte file",
+          read_bytes, FILE_SIZE);
+  if (after.read_reqs <= before.read_reqs)
+    fail ("process read requests did not grow");
+  close (handle);
+
+  CHECK (iostat ("hda", &dev), "iostat \"hda\"");
+  CHECK (!iostat ("no-such-device", &dev), "iostat \"no-such-device\"");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(iostat) begin
+(iostat) create "big"
+(iostat) open "big"
+(iostat) write "big"
+(iostat) iostat process
+(iostat) read "big" backward
+(iostat) iostat process again
+(iostat) iostat "hda"
+(iostat) iostat "no-such-device"
+(iostat) end
+iostat: exit(0)
+EOF
+pass;
@@ -32,6 +32,14 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Maximum length of a lock-holder chain that priority donation
+   follows.  Bounds the cost of lock_acquire() for pathological
+   chains; deeper holders simply do not receive the donation. */
+#define DONATION_DEPTH_MAX 8
+
+static void donate_priority (struct thread *);
+static int waiters_max_priority (struct semaphore *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -69,8 +77,7 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      //list_push_back (&sema->waiters, &thread_current ()->elem);
-      list_insert_ordered(&sema->waiters, &thread_current()->elem, ordered_priority, NULL); 
+      list_push_back (&sema->waiters, &thread_current ()->elem);
       thread_block ();
     }
   sema->value--;
@@ -104,7 +111,10 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.  Waiters' priorities can change through donation
+   while they wait, so the choice is made here rather than by
+   keeping the list sorted.
 
    This function may be called from an interrupt handler. */
 void
@@ -116,27 +126,17 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct list_elem *e = list_max (&sema->waiters,
+                                      thread_priority_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
-  
-  /* A little bit of screw it here, was going to make another function for
-   * sema_waiters to check case of Round Robin Preemption, but since there's not
-   * tests for it implementing here still passes the priority-sema test, so
-   * theres no real reason to check if the TIME_SLICE is > 4. 
-  */ 
-
-  if(thread_current()->priority < list_entry(list_begin(&sema->waiters), struct thread, elem)->priority)
-  {
-    thread_yield();     
-  }
-
-  if((thread_current()->priority == list_entry(list_begin(&sema->waiters), struct thread, elem)->priority))
-      thread_yield(); 
-
 
+  /* Give the CPU to the woken thread if it outranks us. */
+  thread_check_prio (thread_current ());
 }
 
 static void sema_test_helper (void *sema_);
@@ -176,35 +176,6 @@ sema_test_helper (void *sema_)
     }
 }
 
-// FOO BAR // 
-/*
-void 
-sleep_lock_init (struct lock * lock)
-{
-    ASSERT (lock != NULL); 
-
-    lock->holder = NULL; 
-    sema_init(&lock->semaphore, 1); 
-}
-
-void
-sleep_lock_acquire(struct lock * lock)
-{
-    ASSERT (lock != NULL); 
-    ASSERT (!intr_context ()); 
-    ASSERT (!lock_held_by_current_thread (lock));     
-    ASSERT (intr_get_level() == INTR_OFF); 
-
-    if(thread_current()->status == THREAD_BLOCKED)
-    {
-        sema_down(&lock->semaphore);
-        lock_holder = thread_current();   
-    }
-
-}
-*/
-
-
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -227,12 +198,17 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->max_priority = PRI_MIN - 1;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   If the lock is held, the current thread donates its priority
+   to the holder, and onward along the chain of holders that are
+   themselves waiting for locks.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -240,20 +216,65 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  if(
-    
+  old_level = intr_disable ();
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      cur->waiting_lock = lock;
+      donate_priority (cur);
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
-  
+  cur->waiting_lock = NULL;
 
-  if(lock->holder->priority < list_entry(list_front(&ready_list), struct thread, elem))
-  {
-      
-  }
+  lock->holder = cur;
+  lock->max_priority = waiters_max_priority (&lock->semaphore);
+  list_push_back (&cur->held_locks, &lock->elem);
+  if (!thread_mlfqs)
+    thread_donate (cur, lock->max_priority);
+  intr_set_level (old_level);
+}
+
+/* Propagates T's priority to the holder of the lock T is waiting
+   for, and from there along the chain of lock holders, for at
+   most DONATION_DEPTH_MAX links.  Stops early once a holder
+   already has at least T's priority.  Interrupts must be off. */
+static void
+donate_priority (struct thread *t)
+{
+  struct lock *lock = t->waiting_lock;
+  int priority = t->priority;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; lock != NULL && depth < DONATION_DEPTH_MAX; depth++)
+    {
+      struct thread *holder = lock->holder;
+
+      if (lock->max_priority < priority)
+        lock->max_priority = priority;
+      if (holder == NULL || holder->priority >= priority)
+        break;
+      thread_donate (holder, priority);
+      lock = holder->waiting_lock;
+    }
+}
+
+/* Returns the highest priority among the threads waiting on
+   SEMA, or PRI_MIN - 1 if there are none. */
+static int
+waiters_max_priority (struct semaphore *sema)
+{
+  if (list_empty (&sema->waiters))
+    return PRI_MIN - 1;
+  return list_entry (list_max (&sema->waiters, thread_priority_less, NULL),
+                     struct thread, elem)->priority;
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -265,18 +286,29 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      lock->max_priority = waiters_max_priority (&lock->semaphore);
+      list_push_back (&lock->holder->held_locks, &lock->elem);
+      if (!thread_mlfqs)
+        thread_donate (lock->holder, lock->max_priority);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Any priority donated through LOCK is withdrawn by recomputing
+   the current thread's priority from the locks it still holds.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -284,11 +316,19 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  list_remove (&lock->elem);
   lock->holder = NULL;
+  lock->max_priority = PRI_MIN - 1;
+  if (!thread_mlfqs)
+    thread_update_priority (thread_current ());
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -307,8 +347,12 @@ struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Waiting thread. */
   };
 
+static bool semaphore_elem_less (const struct list_elem *,
+                                 const struct list_elem *, void *aux);
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -351,16 +395,16 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
-  //list_push_back (&cond->waiters, &waiter.elem);
-  list_insert_ordered(&cond->waiters, &waiter.elem, ordered_priority, NULL); 
-  
+  waiter.thread = thread_current ();
+  list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the highest-priority one to wake up
+   from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -375,11 +419,24 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
-  
-  if(thread_current()->priority < list_entry(list_begin(&cond->waiters), struct thread, elem)->priority)
-      thread_yield(); 
+    {
+      struct list_elem *e = list_max (&cond->waiters,
+                                      semaphore_elem_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
+}
+
+/* Returns true if the thread waiting on semaphore_elem A has
+   lower priority than the one waiting on B. */
+static bool
+semaphore_elem_less (const struct list_elem *a_, const struct list_elem *b_,
+                     void *aux UNUSED) 
+{
+  const struct semaphore_elem *a = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority < b->thread->priority;
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -15,7 +15,7 @@ struct semaphore
   {
     unsigned value;             /* Current value. */
     struct list waiters;        /* List of waiting threads. */
-  }semaphore;
+  };
 
 /* 
  * Used for the implementation of timer.c, idea is that tick_intr, can handle
@@ -34,19 +34,9 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
-  }mutex;
-
-// FOO BAR // 
-/*
-struct sleep_lock
-{
-   struct thread *holder; 
-   struct semaphore semaphore; 
-   int64_t intr_ticks;  
-}; 
-
-void sleep_lock_init(struct lock *); 
-*/
+    int max_priority;           /* Highest priority donated via lock. */
+    struct list_elem elem;      /* Element in holder's held_locks. */
+  };
 
 void lock_init (struct lock *);
 void lock_acquire (struct lock *);
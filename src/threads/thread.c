@@ -11,6 +11,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -21,19 +22,20 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue: processes in THREAD_READY state, that is, processes
+   that are ready to run but not actually running.  There is one
+   FIFO list per priority level, and bit P of ready_mask is set
+   exactly when ready_queues[P] is nonempty, so the
+   highest-priority ready thread is found with a single bit scan
+   instead of a walk over every runnable thread. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_cnt;           /* # of threads in all ready queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* List of process in THREAD_BUSY state, that is, proccesses
- * that are waiting for an event to trigger.
-static struct list sleep_list; 
-*/
-
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -65,6 +67,15 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler state.  load_avg is
+   updated once per second from ready_cnt, so it costs O(1).
+   Threads whose recent_cpu changed since their priority was last
+   computed sit on cpu_dirty_list, and only those threads have
+   their priorities recomputed every fourth tick. */
+#define MLFQS_PRI_TICKS 4       /* Ticks between priority updates. */
+static fixed_t load_avg;
+static struct list cpu_dirty_list;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -76,13 +87,14 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
-
-void thread_check_prio(struct thread *); 
-void thread_donate(struct thread *); 
-bool check(void); 
-//static void is_max_thread(void); 
-// Using Static so no thread conflicts with other C files.//
-//static void thread_check(void); 
+static void ready_push (struct thread *);
+static struct thread *ready_pop (void);
+static int ready_max_priority (void);
+static void ready_requeue (struct thread *, int priority);
+static void mlfqs_mark_dirty (struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_update_load_avg (void);
+static void mlfqs_update_recent_cpu (void);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -100,11 +112,18 @@ bool check(void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
+  ready_cnt = 0;
   list_init (&all_list);
+  list_init (&cpu_dirty_list);
+  load_avg = 0;
 
   //list_init(&lock_list); 
   
@@ -112,13 +131,6 @@ thread_init (void)
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
-  
-  /* Initilizing donation list for Priority Scheduling */  
-  
-  list_init(&initial_thread->donate); 
-  //sema_init(&initial_thread->semaphore_sleep, 0); 
-  //lock_init(&initial_thread->mutex); 
-
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
 }
@@ -157,6 +169,33 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    {
+      int64_t ticks = timer_ticks ();
+
+      if (t != idle_thread)
+        {
+          t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+          mlfqs_mark_dirty (t);
+        }
+      if (ticks % TIMER_FREQ == 0)
+        {
+          mlfqs_update_load_avg ();
+          mlfqs_update_recent_cpu ();
+        }
+      if (ticks % MLFQS_PRI_TICKS == 0)
+        {
+          while (!list_empty (&cpu_dirty_list))
+            {
+              struct thread *d = list_entry (list_pop_front (&cpu_dirty_list),
+                                             struct thread, cpu_elem);
+              d->cpu_dirty = false;
+              mlfqs_update_priority (d);
+            }
+          thread_check_prio (t);
+        }
+    }
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
@@ -213,6 +252,13 @@ thread_create (const char *name, int priority,
   init_thread(t, name, t->priority = priority); 
   tid = t->tid = allocate_tid(); 
 
+  /* A new thread inherits its parent's niceness and recent CPU
+     time, which under the MLFQS determine its priority. */
+  t->nice = thread_current ()->nice;
+  t->recent_cpu = thread_current ()->recent_cpu;
+  if (thread_mlfqs)
+    mlfqs_update_priority (t);
+
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack' 
      member cannot be observed. */
@@ -246,21 +292,6 @@ thread_create (const char *name, int priority,
 }
 
 
-void
-thread_donate(struct thread * t)
-{
-    ASSERT(!list_empty(&t->donate)); 
-    
-    struct list_elem * e; 
-    for(e = list_begin(&t->donate); e != list_end(&t->donate); e = list_next(e))
-    {
-        t->priority = list_entry(e, struct thread, donate_elem)->priority; 
-    }
-
-    if(thread_current()->priority >= t->priority)
-        return; 
-}
-
 /* Puts the current thread to sleep.  It will not be scheduled
    again until awoken by thread_unblock().
 
@@ -293,9 +324,7 @@ thread_unblock (struct thread *t)
   ASSERT (is_thread (t));
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-
-  list_insert_ordered(&ready_list, &t->elem, ordered_priority, NULL); 
-
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -349,6 +378,8 @@ thread_exit (void)
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  if (thread_current ()->cpu_dirty)
+    list_remove (&thread_current ()->cpu_elem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -366,8 +397,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_insert_ordered(&ready_list, &cur->elem, ordered_priority, NULL); 
-  
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -390,70 +420,143 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
+/* Yields the CPU if some ready thread has a higher priority than
+   T, which must be the running thread.  Safe to call from an
+   interrupt handler, in which case the yield happens on return
+   from the interrupt.  Threads of equal priority share the CPU
+   through the ordinary TIME_SLICE preemption in thread_tick(). */
 void
-thread_check_prio(struct thread * t)
+thread_check_prio (struct thread *t)
 {
-    if(list_empty(&ready_list))
-        return; 
+  enum intr_level old_level;
+  bool preempt;
 
-    if(t->priority < list_entry(list_begin(&ready_list), struct thread, elem)->priority)
-    {
-        thread_yield();     
-    }
+  ASSERT (t == thread_current ());
 
-    if((t->priority == list_entry(list_begin(&ready_list), struct thread, elem)->priority) && (++thread_ticks > TIME_SLICE))
-    {
-        thread_yield(); 
-    }
+  old_level = intr_disable ();
+  preempt = t != idle_thread && ready_max_priority () > t->priority;
+  intr_set_level (old_level);
+
+  if (!preempt)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_yield ();
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.  Its
+   effective priority stays raised while it holds locks that
+   higher-priority threads are waiting for.  Has no effect under
+   the MLFQS, which computes priorities itself. */
 void
 thread_set_priority (int new_priority) 
 {
-    enum intr_level old_level = intr_disable(); 
-    thread_current()->priority = new_priority; 
-    thread_check_prio(thread_current()); 
-    intr_set_level(old_level); 
-} 
-/* Returns the current thread's priority. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_check_prio (cur);
+}
+
+/* Returns the current thread's effective priority. */
 int
 thread_get_priority (void) 
 {
-    //TURN INTERRUPTS OFF TODO// 
-    return thread_current()->priority; 
+  return thread_current ()->priority;
+}
+
+/* Raises T's effective priority to PRIORITY, on behalf of a
+   thread waiting for a lock that T holds.  Does nothing if T's
+   priority is already at least PRIORITY.  Interrupts must be
+   off. */
+void
+thread_donate (struct thread *t, int priority)
+{
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->priority < priority)
+    ready_requeue (t, priority);
+}
+
+/* Recomputes T's effective priority as the maximum of its base
+   priority and the priorities donated through the locks it
+   still holds.  Interrupts must be off. */
+void
+thread_update_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (lock->max_priority > priority)
+        priority = lock->max_priority;
+    }
+  ready_requeue (t, priority);
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_check_prio (cur);
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent_cpu_100;
 }
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -537,16 +640,18 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  list_init (&t->held_locks);
+#ifdef USERPROG
+  t->exit_code = -1;
+  list_init (&t->children);
+#endif
+#ifdef VM
+  list_init (&t->mappings);
+#endif
   t->magic = THREAD_MAGIC;
 
-  sema_init(&t->semaphore_sleep, 0); 
-
   list_push_back (&all_list, &t->allelem);
-  //list_insert_ordered(&all_list, &t->allelem, ordered_donate, NULL); 
-  //thread_print_stats(); 
-  
-  //list_init(&t->donate);  
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -570,30 +675,10 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  if (ready_mask == 0)
     return idle_thread;
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
-
-/*
-  if(list_empty(&ready_list))
-      return idle_thread; 
-  
-  if(thread_current()->priority < list_entry(list_front(&ready_list), struct thread, elem))
-  {
-  struct list_elem * e; 
-  for(e = list_begin(&ready_list); e != list_end(&ready_list); e = list_next(e))
-     {
-        if(list_entry(e, struct thread, elem)->mutex)
-            {
-                list_insert_ordered(&(list_entry(e, struct thread, elem)->donate), &thread_current()->donate_elem, ordered_donate, NULL); 
-                list_entry(e, struct thread, elem)->priority = list_entry(list_front(&list_entry(e, struct thread, elem)->donate) , struct thread, donate_elem)->priority; 
-                list_pop_front(&list_entry(e, struct thread, elem)->donate); 
-                return list_entry(e, struct thread, elem); 
-                //thraead_donate(list_entry(e, struct thread, elem));     
-            }
-     }
-     */
+    return ready_pop ();
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -665,6 +750,158 @@ schedule (void)
   thread_schedule_tail (prev);
 }
 
+/* Appends T to the ready queue for its priority.  Interrupts
+   must be off. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes and returns the first thread in the highest-priority
+   nonempty ready queue.  The run queue must not be empty and
+   interrupts must be off. */
+static struct thread *
+ready_pop (void)
+{
+  int pri = ready_max_priority ();
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (pri >= PRI_MIN);
+
+  t = list_entry (list_pop_front (&ready_queues[pri]), struct thread, elem);
+  if (list_empty (&ready_queues[pri]))
+    ready_mask &= ~((uint64_t) 1 << pri);
+  ready_cnt--;
+  return t;
+}
+
+/* Changes T's priority to PRIORITY.  If T is in the run queue,
+   moves it to the back of the queue for its new priority.
+   Interrupts must be off. */
+static void
+ready_requeue (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (t->status == THREAD_READY && t->priority != priority)
+    {
+      list_remove (&t->elem);
+      if (list_empty (&ready_queues[t->priority]))
+        ready_mask &= ~((uint64_t) 1 << t->priority);
+      t->priority = priority;
+      list_push_back (&ready_queues[priority], &t->elem);
+      ready_mask |= (uint64_t) 1 << priority;
+    }
+  else
+    t->priority = priority;
+}
+
+/* Notes that T's recent_cpu has changed, so that its priority is
+   recomputed at the next priority update. */
+static void
+mlfqs_mark_dirty (struct thread *t)
+{
+  if (!t->cpu_dirty)
+    {
+      t->cpu_dirty = true;
+      list_push_back (&cpu_dirty_list, &t->cpu_elem);
+    }
+}
+
+/* Recomputes T's MLFQS priority from its recent_cpu and nice
+   values:
+
+       priority = PRI_MAX - (recent_cpu / 4) - (nice * 2)
+
+   clamped to the valid range. */
+static void
+mlfqs_update_priority (struct thread *t)
+{
+  int priority;
+
+  if (t == idle_thread)
+    return;
+
+  priority = PRI_MAX - fp_trunc (t->recent_cpu / 4) - t->nice * 2;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  ready_requeue (t, priority);
+}
+
+/* Updates the system load average, once per second:
+
+       load_avg = (59/60) * load_avg + (1/60) * ready_threads
+
+   where ready_threads counts the running thread (unless it is
+   the idle thread) plus everything in the run queue. */
+static void
+mlfqs_update_load_avg (void)
+{
+  int ready_threads = ready_cnt;
+
+  if (thread_current () != idle_thread)
+    ready_threads++;
+  load_avg = (load_avg * 59 + fp_from_int (ready_threads)) / 60;
+}
+
+/* Decays every thread's recent_cpu, once per second:
+
+       recent_cpu = (2*load_avg) / (2*load_avg + 1) * recent_cpu + nice
+
+   Threads whose value actually changes are marked for a
+   priority update; an idle thread with no CPU history and zero
+   niceness is left alone. */
+static void
+mlfqs_update_recent_cpu (void)
+{
+  fixed_t coefficient = fp_div (load_avg * 2, fp_add_int (load_avg * 2, 1));
+  struct list_elem *e;
+
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      fixed_t recent_cpu;
+
+      if (t == idle_thread)
+        continue;
+      recent_cpu = fp_add_int (fp_mul (coefficient, t->recent_cpu), t->nice);
+      if (recent_cpu != t->recent_cpu)
+        {
+          t->recent_cpu = recent_cpu;
+          mlfqs_mark_dirty (t);
+        }
+    }
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   PRI_MIN - 1 if no thread is ready.  The 64-bit mask is scanned
+   as two 32-bit halves so that the compiler emits a BSR
+   instruction rather than a libgcc call. */
+static int
+ready_max_priority (void)
+{
+  uint32_t hi = ready_mask >> 32;
+  uint32_t lo = ready_mask;
+
+  if (hi != 0)
+    return 63 - __builtin_clz (hi);
+  else if (lo != 0)
+    return 31 - __builtin_clz (lo);
+  else
+    return PRI_MIN - 1;
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) 
@@ -682,46 +919,15 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
-/*
-  Used by timer_sleep to provide an ordering to the sleep list.
-  Threads with the least amount of intr_time are placed first in the list.
-*/ 
+/* Returns true if thread A, an element of a list through its
+   `elem' member, has lower effective priority than thread B.
+   Used with list_max() to pick the highest-priority waiter. */
 bool
-check()
-{
-    if(list_empty(&ready_list))
-        return true;     
-
-}
-bool ordered_sleep(const struct list_elem * left, const struct list_elem * right,void * aux UNUSED)
+thread_priority_less (const struct list_elem *a_, const struct list_elem *b_,
+                      void *aux UNUSED) 
 {
-    const struct thread * thread_left = list_entry(left, struct thread, sleep_elem); 
-    const struct thread * thread_right = list_entry(right, struct thread, sleep_elem); 
-    
-    //if(thread_left->intr_time != thread_right->intr_time)
-        return thread_left->intr_time < thread_right->intr_time; 
-}
-
-/*
-  Used for priority donation, threads are ordered in donations list. 
-  Threads with the highest priority first.
-*/ 
-bool ordered_donate(const struct list_elem * left, const struct list_elem * right, void * aux UNUSED)
-{
-    
-    const struct thread * thread_left = list_entry(left, struct thread, donate_elem); 
-    
-    const struct thread * thread_right = list_entry(right, struct thread, donate_elem); 
-   
-    return thread_left->priority > thread_right->priority; 
-   
-}
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
 
-bool ordered_priority(const struct list_elem * left, const struct list_elem * right, void * aux UNUSED)
-{
-    const struct thread * thread_left = list_entry(left, struct thread, elem); 
-    const struct thread * thread_right = list_entry(right, struct thread, elem); 
-
-    return thread_left->priority > thread_right->priority; 
+  return a->priority < b->priority;
 }
-
@@ -6,6 +6,7 @@
 #include <stdint.h>
 /* Include Synch.h */ 
 #include "synch.h"
+#include "threads/fixed-point.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -26,6 +27,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /* Nicest to other threads. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -89,34 +95,66 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Effective priority. */
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
-    /* Create Global lock and initilize to test if current thread is locked */
-    struct lock  mutex; 
-    
-    /* When should a thread wakeup? intr_time stores when. */ 
-    int64_t intr_time; 
-    
-    /* Used so we can iterate and push into the sleep_list, for timer_sleep */ 
-    struct list_elem sleep_elem;    
-
-    /* Priority Donation List, idea is too keep track of donations */ 
-    struct list donate;
-
-    /*Donation element for list_insert_ordered */ 
-    struct list_elem donate_elem;
-    
-    struct semaphore semaphore_sleep; 
-    /* Check if thread is locked */ 
-    //lock_held_by_current_thread(lock); 
+    /* Priority donation, shared between thread.c and synch.c. */
+    int base_priority;                  /* Priority before donations. */
+    struct lock *waiting_lock;          /* Lock being waited for. */
+    struct list held_locks;             /* Locks held, for donations. */
+
+    /* Owned by thread.c, for the multi-level feedback queue
+       scheduler. */
+    int nice;                           /* Niceness. */
+    fixed_t recent_cpu;                 /* Recent CPU time received. */
+    bool cpu_dirty;                     /* On cpu_dirty_list? */
+    struct list_elem cpu_elem;          /* cpu_dirty_list element. */
+
+    /* Owned by devices/timer.c. */
+    int64_t intr_time;                  /* Tick at which to wake up. */
+    struct list_elem sleep_elem;        /* Timing wheel list element. */
+
+    /* Owned by devices/block.c. */
+    unsigned long long io_read_bytes;   /* Bytes read from block devices. */
+    unsigned long long io_write_bytes;  /* Bytes written to block devices. */
+    unsigned long long io_read_reqs;    /* Block read requests. */
+    unsigned long long io_write_reqs;   /* Block write requests. */
+    int io_depth;                       /* Nesting of block requests. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    int exit_code;                      /* Exit code. */
+    struct wait_status *wait_status;    /* This process's completion. */
+    struct list children;               /* Completion of children. */
+    struct file *bin_file;              /* Executable, kept write-denied. */
+
+    /* Owned by userprog/syscall.c. */
+    struct fd_entry *fds;               /* Open files, indexed by handle. */
+    size_t fd_cnt;                      /* Number of slots in fds. */
+    struct bitmap *fd_map;              /* Handles in use. */
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+
+    /* Owned by userprog/syscall.c. */
+    void *user_esp;                     /* User ESP at system call. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping identifier. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Working directory, or null
+                                           for the root directory. */
+
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal_begin(). */
 #endif
 
     /* Owned by thread.c. */
@@ -146,6 +184,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_check_prio (struct thread *);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -153,17 +192,14 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate (struct thread *, int priority);
+void thread_update_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-
-
-//void check_thread_prio(struct thread * ); 
-//void is_max_thread(void); 
-bool ordered_sleep(const struct list_elem * left, const struct list_elem * right,void * aux UNUSED); 
-bool ordered_donate(const struct list_elem * left, const struct list_elem * right, void * aux UNUSED); 
-bool ordered_priority(const struct list_elem * left, const struct list_elem * right, void * aux UNUSED); 
+bool thread_priority_less (const struct list_elem *, const struct list_elem *,
+                           void *aux);
 #endif /* threads/thread.h */
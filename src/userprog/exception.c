@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,9 +152,30 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in a page of the process's address space on first
+     touch, whether by the process itself or by the kernel on its
+     behalf, growing the stack if need be.  A fault in the kernel
+     comes from a system call, which saved the user's ESP. */
+  if (not_present && is_user_vaddr (fault_addr))
+    {
+      void *esp = user ? f->esp : thread_current ()->user_esp;
+      if (page_in (fault_addr) || page_grow_stack (fault_addr, esp))
+        return;
+    }
+#endif
+
+  /* A fault in the kernel at a user address comes from one of
+     the user memory accessors in userprog/syscall.c, which put
+     the address to resume at in EAX.  Resume there with EAX set
+     to -1 to report the failure. */
+  if (!user && is_user_vaddr (fault_addr))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
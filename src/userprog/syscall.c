@@ -1,20 +1,888 @@
 #include "userprog/syscall.h"
+#include <bitmap.h>
+#include <list.h>
+#include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "userprog/process.h"
+#include "devices/block.h"
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Serializes access to the file system, which is not yet safe
+   for concurrent use. */
+struct lock filesys_lock;
 
 static void syscall_handler (struct intr_frame *);
 
+static int sys_halt (void);
+static int sys_exit (int status);
+static int sys_exec (const char *ufile);
+static int sys_wait (tid_t);
+static int sys_create (const char *ufile, unsigned initial_size);
+static int sys_remove (const char *ufile);
+static int sys_open (const char *ufile);
+static int sys_filesize (int handle);
+static int sys_read (int handle, void *udst, unsigned size);
+static int sys_write (int handle, const void *usrc, unsigned size);
+static int sys_seek (int handle, unsigned position);
+static int sys_tell (int handle);
+static int sys_close (int handle);
+static int sys_chdir (const char *udir);
+static int sys_mkdir (const char *udir);
+static int sys_readdir (int handle, char *uname);
+static int sys_isdir (int handle);
+static int sys_inumber (int handle);
+static int sys_iostat (const char *udevice, struct iostat *ustats);
+#ifdef VM
+static int sys_mmap (int handle, void *addr);
+static int sys_munmap (int mapping);
+#endif
+
+/* System call handler function, taking up to three word-sized
+   arguments. */
+typedef int syscall_function (int, int, int);
+
+/* A system call. */
+struct syscall
+  {
+    size_t arg_cnt;           /* Number of arguments. */
+    syscall_function *func;   /* Implementation. */
+  };
+
+/* Declares system call NR, implemented by FUNC with ARG_CNT
+   arguments.  Each implementation takes its own argument types;
+   under the i386 calling convention the caller cleans up the
+   stack, so calling it through syscall_function with extra
+   arguments is harmless.  The cast through a pointer to
+   "void (void)" tells GCC that this is deliberate. */
+#define SYSCALL(NR, ARG_CNT, FUNC) \
+  [NR] = {ARG_CNT, (syscall_function *) (void (*) (void)) FUNC}
+
+/* Table of system calls, indexed by system call number.  Calls
+   without an implementation have a null FUNC and kill the
+   process that invokes them. */
+static const struct syscall syscall_table[] =
+  {
+    SYSCALL (SYS_HALT, 0, sys_halt),
+    SYSCALL (SYS_EXIT, 1, sys_exit),
+    SYSCALL (SYS_EXEC, 1, sys_exec),
+    SYSCALL (SYS_WAIT, 1, sys_wait),
+    SYSCALL (SYS_CREATE, 2, sys_create),
+    SYSCALL (SYS_REMOVE, 1, sys_remove),
+    SYSCALL (SYS_OPEN, 1, sys_open),
+    SYSCALL (SYS_FILESIZE, 1, sys_filesize),
+    SYSCALL (SYS_READ, 3, sys_read),
+    SYSCALL (SYS_WRITE, 3, sys_write),
+    SYSCALL (SYS_SEEK, 2, sys_seek),
+    SYSCALL (SYS_TELL, 1, sys_tell),
+    SYSCALL (SYS_CLOSE, 1, sys_close),
+    SYSCALL (SYS_CHDIR, 1, sys_chdir),
+    SYSCALL (SYS_MKDIR, 1, sys_mkdir),
+    SYSCALL (SYS_READDIR, 2, sys_readdir),
+    SYSCALL (SYS_ISDIR, 1, sys_isdir),
+    SYSCALL (SYS_INUMBER, 1, sys_inumber),
+    SYSCALL (SYS_IOSTAT, 2, sys_iostat),
+#ifdef VM
+    SYSCALL (SYS_MMAP, 2, sys_mmap),
+    SYSCALL (SYS_MUNMAP, 1, sys_munmap),
+#endif
+  };
+
+#define SYSCALL_CNT (sizeof syscall_table / sizeof *syscall_table)
+
 void
-syscall_init (void) 
+syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  lock_init (&filesys_lock);
+}
+
+static void copy_in (void *, const void *, size_t);
+
+/* System call handler.  The system call number and its arguments
+   are words on the user stack at F->esp. */
+static void
+syscall_handler (struct intr_frame *f)
+{
+  const struct syscall *sc;
+  unsigned call_nr;
+  int args[3];
+
+#ifdef VM
+  /* Page faults in the kernel need the user stack pointer to
+     tell stack growth from a bad access. */
+  thread_current ()->user_esp = f->esp;
+#endif
+
+  copy_in (&call_nr, f->esp, sizeof call_nr);
+  if (call_nr >= SYSCALL_CNT || syscall_table[call_nr].func == NULL)
+    sys_exit (-1);
+  sc = syscall_table + call_nr;
+
+  ASSERT (sc->arg_cnt <= sizeof args / sizeof *args);
+  memset (args, 0, sizeof args);
+  copy_in (args, (uint32_t *) f->esp + 1, sizeof *args * sc->arg_cnt);
+
+  f->eax = sc->func (args[0], args[1], args[2]);
+}
+
+/* User memory access.
+
+   These helpers never check page tables.  Instead they touch
+   user memory directly and rely on page_fault() to recover: a
+   fault in kernel mode at a user address makes the handler copy
+   EAX (which holds the address of the instruction following the
+   access) into EIP and set EAX to -1. */
+
+/* Reads a byte at user virtual address UADDR, which must be
+   below PHYS_BASE.  Returns the byte value if successful, -1 if
+   a page fault occurred. */
+static inline int
+get_user (const uint8_t *uaddr)
+{
+  int result;
+  asm ("movl $1f, %0; movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST, which must be below
+   PHYS_BASE.  Returns true if successful, false if a page fault
+   occurred. */
+static inline bool
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  asm ("movl $1f, %0; movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Kills the process if any of the user bytes is invalid. */
+static void
+copy_in (void *dst_, const void *usrc_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+
+  for (; size > 0; size--, dst++, usrc++)
+    {
+      int byte;
+      if (usrc >= (uint8_t *) PHYS_BASE || (byte = get_user (usrc)) == -1)
+        sys_exit (-1);
+      *dst = byte;
+    }
+}
+
+/* Creates a copy of user string US in kernel memory and returns
+   it as a page that must be freed with palloc_free_page().
+   Truncates the string at PGSIZE bytes in size.  Kills the
+   process if any of the user accesses is invalid. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks;
+  size_t length;
+
+  ks = palloc_get_page (0);
+  if (ks == NULL)
+    thread_exit ();
+
+  for (length = 0; length < PGSIZE; length++)
+    {
+      const uint8_t *uaddr = (const uint8_t *) us + length;
+      int byte;
+
+      if (uaddr >= (uint8_t *) PHYS_BASE || (byte = get_user (uaddr)) == -1)
+        {
+          palloc_free_page (ks);
+          sys_exit (-1);
+        }
+      ks[length] = byte;
+      if (byte == '\0')
+        return ks;
+    }
+  ks[PGSIZE - 1] = '\0';
+  return ks;
+}
+
+/* Verifies that the SIZE bytes at user address UADDR are mapped,
+   and writable if WRITABLE is true, killing the process if not.
+   Only one byte per page is probed, so that the buffer can then
+   be handed directly to the file system instead of being copied
+   a byte at a time. */
+static void
+verify_user_buffer (const void *uaddr, size_t size, bool writable)
+{
+  const uint8_t *p = uaddr;
+  const uint8_t *end = p + size;
+
+  if (size == 0)
+    return;
+  if (end < p || end > (const uint8_t *) PHYS_BASE)
+    sys_exit (-1);
+
+  while (p < end)
+    {
+      int byte = get_user (p);
+      if (byte == -1 || (writable && !put_user ((uint8_t *) p, byte)))
+        sys_exit (-1);
+      p = (const uint8_t *) pg_round_down (p) + PGSIZE;
+    }
+}
+
+#ifdef VM
+/* Unlocks the pages from the one containing START up to END. */
+static void
+unlock_user_pages (const uint8_t *start, const uint8_t *end)
+{
+  const uint8_t *p;
+
+  for (p = pg_round_down (start); p < end; p += PGSIZE)
+    page_unlock (p);
+}
+
+/* Locks the SIZE bytes at user address UADDR, already checked
+   with verify_user_buffer(), into memory until
+   unlock_user_buffer().  The file system can then access them
+   while it holds filesys_lock without faulting, which could
+   otherwise deadlock with a thread evicting a memory-mapped page
+   to its file. */
+static void
+lock_user_buffer (const void *uaddr, size_t size)
+{
+  const uint8_t *start = uaddr;
+  const uint8_t *p;
+
+  for (p = pg_round_down (start); p < start + size; p += PGSIZE)
+    if (!page_lock (p))
+      {
+        unlock_user_pages (start, p);
+        sys_exit (-1);
+      }
 }
 
+/* Unlocks the SIZE bytes at UADDR locked by lock_user_buffer(). */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+unlock_user_buffer (const void *uaddr, size_t size)
 {
-  printf ("system call!\n");
+  unlock_user_pages (uaddr, (const uint8_t *) uaddr + size);
+}
+#endif
+
+/* Halt system call. */
+static int
+sys_halt (void)
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call. */
+static int
+sys_exit (int exit_code)
+{
+  thread_current ()->exit_code = exit_code;
   thread_exit ();
+  NOT_REACHED ();
+}
+
+/* Exec system call. */
+static int
+sys_exec (const char *ufile)
+{
+  tid_t tid;
+  char *kfile = copy_in_string (ufile);
+
+  tid = process_execute (kfile);
+  palloc_free_page (kfile);
+  return tid;
+}
+
+/* Wait system call. */
+static int
+sys_wait (tid_t child)
+{
+  return process_wait (child);
+}
+
+/* Create system call. */
+static int
+sys_create (const char *ufile, unsigned initial_size)
+{
+  char *kfile = copy_in_string (ufile);
+  bool ok;
+
+  lock_acquire (&filesys_lock);
+  ok = filesys_create (kfile, initial_size);
+  lock_release (&filesys_lock);
+
+  palloc_free_page (kfile);
+  return ok;
+}
+
+/* Remove system call. */
+static int
+sys_remove (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  bool ok;
+
+  lock_acquire (&filesys_lock);
+  ok = filesys_remove (kfile);
+  lock_release (&filesys_lock);
+
+  palloc_free_page (kfile);
+  return ok;
+}
+
+/* Per-process file descriptor table.
+
+   Each process has an array of open files indexed directly by
+   handle, so that lookups are O(1), and a bitmap of the handles
+   in use, so that open() can hand out the lowest free handle
+   with a single scan.  Handles 0 and 1 are permanently marked in
+   use for the console.  The table is allocated on first open and
+   doubles in size whenever it fills up. */
+
+#define FD_TABLE_INITIAL 16     /* Initial number of slots. */
+
+/* A slot in the descriptor table. */
+struct fd_entry
+  {
+    struct file *file;          /* Open file, or null if slot is free. */
+    struct dir *dir;            /* Open directory, if FILE is one. */
+  };
+
+/* Grows the current process's descriptor table to at least
+   MIN_CNT slots.  Returns true if successful, false if memory
+   is exhausted. */
+static bool
+fd_table_grow (size_t min_cnt)
+{
+  struct thread *cur = thread_current ();
+  size_t new_cnt = cur->fd_cnt > 0 ? cur->fd_cnt : FD_TABLE_INITIAL;
+  struct fd_entry *fds;
+  struct bitmap *map;
+  size_t i;
+
+  while (new_cnt < min_cnt)
+    new_cnt *= 2;
+
+  map = bitmap_create (new_cnt);
+  if (map == NULL)
+    return false;
+  fds = realloc (cur->fds, new_cnt * sizeof *fds);
+  if (fds == NULL)
+    {
+      bitmap_destroy (map);
+      return false;
+    }
+
+  for (i = 0; i < new_cnt; i++)
+    if (i < cur->fd_cnt)
+      bitmap_set (map, i, bitmap_test (cur->fd_map, i));
+    else
+      fds[i].file = NULL;
+  bitmap_mark (map, STDIN_FILENO);
+  bitmap_mark (map, STDOUT_FILENO);
+
+  if (cur->fd_map != NULL)
+    bitmap_destroy (cur->fd_map);
+  cur->fds = fds;
+  cur->fd_map = map;
+  cur->fd_cnt = new_cnt;
+  return true;
+}
+
+/* Installs FILE, and DIR if FILE is a directory, in the lowest
+   free slot of the current process's descriptor table and
+   returns its handle, or -1 if memory is exhausted. */
+static int
+fd_install (struct file *file, struct dir *dir)
+{
+  struct thread *cur = thread_current ();
+  size_t handle = BITMAP_ERROR;
+
+  if (cur->fd_map != NULL)
+    handle = bitmap_scan_and_flip (cur->fd_map, 0, 1, false);
+  if (handle == BITMAP_ERROR)
+    {
+      size_t old_cnt = cur->fd_cnt;
+      if (!fd_table_grow (old_cnt + 1))
+        return -1;
+      handle = bitmap_scan_and_flip (cur->fd_map, old_cnt, 1, false);
+      ASSERT (handle != BITMAP_ERROR);
+    }
+
+  cur->fds[handle].file = file;
+  cur->fds[handle].dir = dir;
+  return handle;
+}
+
+/* Closes the file and directory, if any, in descriptor table
+   slot FD.  The caller must hold filesys_lock. */
+static void
+fd_close (struct fd_entry *fd)
+{
+  dir_close (fd->dir);
+  file_close (fd->file);
+  fd->file = NULL;
+  fd->dir = NULL;
+}
+
+/* Open system call. */
+static int
+sys_open (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  struct fd_entry fd;
+  int handle = -1;
+
+  lock_acquire (&filesys_lock);
+  fd.file = filesys_open (kfile);
+  fd.dir = NULL;
+  if (fd.file != NULL)
+    {
+      struct inode *inode = file_get_inode (fd.file);
+      if (inode_is_dir (inode))
+        fd.dir = dir_open (inode_reopen (inode));
+      if (!inode_is_dir (inode) || fd.dir != NULL)
+        handle = fd_install (fd.file, fd.dir);
+      if (handle < 0)
+        fd_close (&fd);
+    }
+  lock_release (&filesys_lock);
+
+  palloc_free_page (kfile);
+  return handle;
+}
+
+/* Returns the descriptor table slot for the given handle.
+   Terminates the process if HANDLE is not associated with an
+   open file or directory. */
+static struct fd_entry *
+lookup_fd_entry (int handle)
+{
+  struct thread *cur = thread_current ();
+
+  if (handle < 0 || (size_t) handle >= cur->fd_cnt
+      || cur->fds[handle].file == NULL)
+    sys_exit (-1);
+  return &cur->fds[handle];
+}
+
+/* Returns the file associated with the given handle.  Terminates
+   the process if HANDLE is not associated with an open file. */
+static struct file *
+lookup_fd (int handle)
+{
+  return lookup_fd_entry (handle)->file;
+}
+
+/* Returns the directory associated with the given handle, or a
+   null pointer if HANDLE refers to an ordinary file.  Terminates
+   the process if HANDLE is not associated with an open file. */
+static struct dir *
+lookup_dir (int handle)
+{
+  return lookup_fd_entry (handle)->dir;
+}
+
+/* Filesize system call. */
+static int
+sys_filesize (int handle)
+{
+  struct file *file = lookup_fd (handle);
+  int size;
+
+  lock_acquire (&filesys_lock);
+  size = file_length (file);
+  lock_release (&filesys_lock);
+
+  return size;
+}
+
+/* Read system call. */
+static int
+sys_read (int handle, void *udst, unsigned size)
+{
+  struct file *file;
+  int bytes_read = 0;
+
+  verify_user_buffer (udst, size, true);
+
+  /* Handle keyboard reads. */
+  if (handle == STDIN_FILENO)
+    {
+      uint8_t *dst = udst;
+      unsigned i;
+
+      for (i = 0; i < size; i++)
+        dst[i] = input_getc ();
+      return size;
+    }
+
+  /* Handle all other reads, a page of the buffer at a time, so
+     that a large read never holds much of memory locked. */
+  file = lookup_fd (handle);
+  if (lookup_dir (handle) != NULL)
+    return -1;
+  while (size > 0)
+    {
+      uint8_t *dst = (uint8_t *) udst + bytes_read;
+      size_t page_left = PGSIZE - pg_ofs (dst);
+      size_t chunk = size < page_left ? size : page_left;
+      off_t n;
+
+#ifdef VM
+      lock_user_buffer (dst, chunk);
+#endif
+      lock_acquire (&filesys_lock);
+      n = file_read (file, dst, chunk);
+      lock_release (&filesys_lock);
+#ifdef VM
+      unlock_user_buffer (dst, chunk);
+#endif
+      bytes_read += n;
+      size -= n;
+      if ((size_t) n != chunk)
+        break;
+    }
+  return bytes_read;
+}
+
+/* Write system call. */
+static int
+sys_write (int handle, const void *usrc, unsigned size)
+{
+  struct file *file;
+  int bytes_written = 0;
+
+  verify_user_buffer (usrc, size, false);
+
+  /* Handle console writes. */
+  if (handle == STDOUT_FILENO)
+    {
+      putbuf (usrc, size);
+      return size;
+    }
+
+  /* Handle all other writes, a page at a time, as for reads. */
+  file = lookup_fd (handle);
+  if (lookup_dir (handle) != NULL)
+    return -1;
+  while (size > 0)
+    {
+      const uint8_t *src = (const uint8_t *) usrc + bytes_written;
+      size_t page_left = PGSIZE - pg_ofs (src);
+      size_t chunk = size < page_left ? size : page_left;
+      off_t n;
+
+#ifdef VM
+      lock_user_buffer (src, chunk);
+#endif
+      lock_acquire (&filesys_lock);
+      n = file_write (file, src, chunk);
+      lock_release (&filesys_lock);
+#ifdef VM
+      unlock_user_buffer (src, chunk);
+#endif
+      bytes_written += n;
+      size -= n;
+      if ((size_t) n != chunk)
+        break;
+    }
+  return bytes_written;
+}
+
+/* Seek system call. */
+static int
+sys_seek (int handle, unsigned position)
+{
+  struct file *file = lookup_fd (handle);
+
+  lock_acquire (&filesys_lock);
+  if ((off_t) position >= 0)
+    file_seek (file, position);
+  lock_release (&filesys_lock);
+
+  return 0;
+}
+
+/* Tell system call. */
+static int
+sys_tell (int handle)
+{
+  struct file *file = lookup_fd (handle);
+  unsigned position;
+
+  lock_acquire (&filesys_lock);
+  position = file_tell (file);
+  lock_release (&filesys_lock);
+
+  return position;
+}
+
+/* Close system call. */
+static int
+sys_close (int handle)
+{
+  struct thread *cur = thread_current ();
+  struct fd_entry *fd = lookup_fd_entry (handle);
+
+  lock_acquire (&filesys_lock);
+  fd_close (fd);
+  lock_release (&filesys_lock);
+  bitmap_reset (cur->fd_map, handle);
+  return 0;
+}
+
+/* Chdir system call. */
+static int
+sys_chdir (const char *udir)
+{
+  char *kdir = copy_in_string (udir);
+  bool ok;
+
+  lock_acquire (&filesys_lock);
+  ok = filesys_chdir (kdir);
+  lock_release (&filesys_lock);
+
+  palloc_free_page (kdir);
+  return ok;
+}
+
+/* Mkdir system call. */
+static int
+sys_mkdir (const char *udir)
+{
+  char *kdir = copy_in_string (udir);
+  bool ok;
+
+  lock_acquire (&filesys_lock);
+  ok = filesys_mkdir (kdir);
+  lock_release (&filesys_lock);
+
+  palloc_free_page (kdir);
+  return ok;
+}
+
+/* Readdir system call. */
+static int
+sys_readdir (int handle, char *uname)
+{
+  struct dir *dir = lookup_dir (handle);
+  char name[NAME_MAX + 1];
+  bool ok;
+
+  verify_user_buffer (uname, sizeof name, true);
+  if (dir == NULL)
+    return false;
+
+  lock_acquire (&filesys_lock);
+  ok = dir_readdir (dir, name);
+  lock_release (&filesys_lock);
+
+  if (ok)
+    memcpy (uname, name, strlen (name) + 1);
+  return ok;
+}
+
+/* Isdir system call. */
+static int
+sys_isdir (int handle)
+{
+  return lookup_dir (handle) != NULL;
+}
+
+/* Inumber system call. */
+static int
+sys_inumber (int handle)
+{
+  return inode_get_inumber (file_get_inode (lookup_fd (handle)));
+}
+
+/* Iostat system call.  Reports statistics for the block device
+   named UDEVICE, or for the calling process if UDEVICE is null. */
+static int
+sys_iostat (const char *udevice, struct iostat *ustats)
+{
+  struct iostat stats;
+  bool ok = true;
+
+  verify_user_buffer (ustats, sizeof stats, true);
+  if (udevice == NULL)
+    block_get_thread_stats (&stats);
+  else
+    {
+      char *kdevice = copy_in_string (udevice);
+      ok = block_get_stats (kdevice, &stats);
+      palloc_free_page (kdevice);
+    }
+
+  if (ok)
+    memcpy (ustats, &stats, sizeof stats);
+  return ok;
+}
+
+#ifdef VM
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;      /* Element in thread's `mappings'. */
+    int handle;                 /* Mapping identifier. */
+    struct file *file;          /* File, reopened for the mapping. */
+    uint8_t *base;              /* Start of mapping. */
+    size_t page_cnt;            /* Number of pages mapped. */
+  };
+
+/* Removes the first PAGE_CNT pages of mapping M from the current
+   process's address space, writing back those that were
+   modified. */
+static void
+unmap_pages (struct mapping *m, size_t page_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    page_deallocate (m->base + i * PGSIZE);
+}
+
+/* Removes mapping M, writing back its modified pages, and frees
+   it. */
+static void
+unmap (struct mapping *m)
+{
+  unmap_pages (m, m->page_cnt);
+  list_remove (&m->elem);
+  lock_acquire (&filesys_lock);
+  file_close (m->file);
+  lock_release (&filesys_lock);
+  free (m);
+}
+
+/* Mmap system call.  Pages of the mapping are read from the file
+   when first touched, like those of the executable. */
+static int
+sys_mmap (int handle, void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct mapping *m;
+  off_t length;
+  size_t i;
+
+  if (handle == STDIN_FILENO || handle == STDOUT_FILENO
+      || addr == NULL || pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+      || lookup_dir (handle) != NULL)
+    return -1;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return -1;
+
+  lock_acquire (&filesys_lock);
+  m->file = file_reopen (lookup_fd (handle));
+  length = m->file != NULL ? file_length (m->file) : 0;
+  lock_release (&filesys_lock);
+
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  if (length == 0
+      || m->page_cnt > (size_t) ((uint8_t *) PHYS_BASE - m->base) / PGSIZE)
+    goto fail;
+
+  /* Add the pages, failing if any overlaps an existing page. */
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      struct page *p = page_allocate (m->base + ofs, true);
+      if (p == NULL)
+        {
+          unmap_pages (m, i);
+          goto fail;
+        }
+      p->file = m->file;
+      p->file_offset = ofs;
+      p->read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      p->mapped = true;
+    }
+
+  m->handle = cur->next_mapid++;
+  list_push_back (&cur->mappings, &m->elem);
+  return m->handle;
+
+ fail:
+  lock_acquire (&filesys_lock);
+  file_close (m->file);
+  lock_release (&filesys_lock);
+  free (m);
+  return -1;
+}
+
+/* Munmap system call. */
+static int
+sys_munmap (int mapping)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->handle == mapping)
+        {
+          unmap (m);
+          return 0;
+        }
+    }
+  sys_exit (-1);
+  NOT_REACHED ();
+}
+#endif
+
+/* On thread exit, remove all memory mappings, close all open
+   files and directories, and free the descriptor table. */
+void
+syscall_exit (void)
+{
+  struct thread *cur = thread_current ();
+  size_t handle;
+
+#ifdef VM
+  while (!list_empty (&cur->mappings))
+    unmap (list_entry (list_front (&cur->mappings), struct mapping, elem));
+#endif
+
+  if (cur->fd_map == NULL)
+    return;
+
+  lock_acquire (&filesys_lock);
+  for (handle = bitmap_scan (cur->fd_map, 0, 1, true);
+       handle != BITMAP_ERROR;
+       handle = bitmap_scan (cur->fd_map, handle + 1, 1, true))
+    if (cur->fds[handle].file != NULL)
+      fd_close (&cur->fds[handle]);
+  lock_release (&filesys_lock);
+
+  free (cur->fds);
+  bitmap_destroy (cur->fd_map);
+  cur->fds = NULL;
+  cur->fd_map = NULL;
+  cur->fd_cnt = 0;
 }
@@ -0,0 +1,238 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include "vm/page.h"
+#include "vm/swap.h"
+#include "devices/timer.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+
+/* Frame table.
+
+   Every page in the user pool is claimed at startup and handed
+   out by frame_alloc_and_lock().  When no frame is free, a
+   victim is chosen with the clock (second chance) algorithm: the
+   hand sweeps the table, clearing the accessed bit of each page
+   it passes, and evicts the first page whose bit was already
+   clear.  A page that must be saved is not evicted alone: the
+   sweep goes on to gather up to SWAP_CLUSTER such pages, which
+   are written out together, and the frames not needed right
+   away are left free for later allocations.
+
+   A frame's lock must be held to change its PAGE or the page's
+   mapping.  The scan only ever tries to acquire frame locks, so
+   a frame being loaded or freed is simply skipped. */
+
+/* Number of times to sweep the table for a victim before giving
+   up on an allocation. */
+#define ALLOC_TRIES 3
+
+static struct frame *frames;
+static size_t frame_cnt;
+
+static struct lock scan_lock;   /* Serializes scans. */
+static size_t hand;             /* Clock hand. */
+
+/* Initializes the frame table, taking every page in the user
+   pool. */
+void
+frame_init (void)
+{
+  void *base;
+
+  lock_init (&scan_lock);
+
+  frames = malloc (sizeof *frames * init_ram_pages);
+  if (frames == NULL)
+    PANIC ("out of memory allocating page frames");
+
+  while ((base = palloc_get_page (PAL_USER)) != NULL)
+    {
+      struct frame *f = &frames[frame_cnt++];
+      lock_init (&f->lock);
+      f->base = base;
+      f->page = NULL;
+    }
+}
+
+/* Tries once to find a frame for PAGE, first among free frames
+   and then by evicting a page.  Returns the frame, locked, or a
+   null pointer if none could be found. */
+static struct frame *
+try_frame_alloc_and_lock (struct page *page)
+{
+  struct frame *cluster[SWAP_CLUSTER];
+  size_t cluster_cnt = 0;
+  struct frame *victim = NULL;
+  size_t i;
+
+  lock_acquire (&scan_lock);
+
+  /* Find a free frame. */
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f = &frames[i];
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        continue;
+      if (f->page == NULL)
+        {
+          f->page = page;
+          lock_release (&scan_lock);
+          return f;
+        }
+      lock_release (&f->lock);
+    }
+
+  /* No free frame.  Find one to evict.  Two full turns of the
+     clock are enough to find a victim if any page is
+     evictable. */
+  for (i = 0; i < frame_cnt * 2 && cluster_cnt < SWAP_CLUSTER; i++)
+    {
+      struct frame *f = &frames[hand];
+      if (++hand >= frame_cnt)
+        hand = 0;
+
+      /* Skip frames in use, including those already gathered. */
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        continue;
+
+      if (f->page == NULL)
+        {
+          victim = f;
+          break;
+        }
+
+      if (page_accessed_recently (f->page))
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+
+      if (!page_unmap (f->page))
+        {
+          /* Clean page, dropped. */
+          victim = f;
+          break;
+        }
+      cluster[cluster_cnt++] = f;
+    }
+  lock_release (&scan_lock);
+
+  /* Save the gathered pages: memory-mapped pages to their files,
+     the rest to swap together.  Pages that don't fit in swap
+     stay where they are.
+
+     Each page keeps its frame until the frame is released below.
+     Until then, an owner that faults on the page, or exits,
+     waits for the frame lock; once it is released, the page must
+     no longer be touched, since the owner may free it. */
+  if (cluster_cnt > 0)
+    {
+      struct page *pages[SWAP_CLUSTER];
+      bool saved[SWAP_CLUSTER];
+      size_t swap_cnt = 0;
+      size_t swapped;
+
+      for (i = 0; i < cluster_cnt; i++)
+        {
+          struct page *p = cluster[i]->page;
+          saved[i] = p->mapped;
+          if (p->mapped)
+            page_write_back (p);
+          else
+            pages[swap_cnt++] = p;
+        }
+
+      /* swap_out() saves the first SWAPPED of PAGES, which are the
+         first SWAPPED unmapped pages in CLUSTER. */
+      swapped = swap_cnt > 0 ? swap_out (pages, swap_cnt) : 0;
+      for (i = 0; i < cluster_cnt && swapped > 0; i++)
+        if (!saved[i])
+          {
+            saved[i] = true;
+            swapped--;
+          }
+
+      for (i = 0; i < cluster_cnt; i++)
+        {
+          struct frame *f = cluster[i];
+          if (!saved[i])
+            {
+              page_remap (f->page);
+              frame_unlock (f);
+              continue;
+            }
+
+          f->page->frame = NULL;
+          if (victim == NULL)
+            victim = f;
+          else
+            frame_free (f);
+        }
+    }
+
+  if (victim != NULL)
+    victim->page = page;
+  return victim;
+}
+
+/* Allocates a frame for PAGE and returns it, locked.  Returns a
+   null pointer if every frame is in use and none can be
+   evicted. */
+struct frame *
+frame_alloc_and_lock (struct page *page)
+{
+  int try;
+
+  for (try = 0; try < ALLOC_TRIES; try++)
+    {
+      struct frame *f = try_frame_alloc_and_lock (page);
+      if (f != NULL)
+        {
+          ASSERT (lock_held_by_current_thread (&f->lock));
+          return f;
+        }
+      timer_msleep (1);
+    }
+  return NULL;
+}
+
+/* Locks P's frame, if it has one, so that it cannot be evicted.
+   P->FRAME may be cleared while we wait, if the frame is evicted
+   from under us; in that case nothing is locked. */
+void
+frame_lock (struct page *p)
+{
+  struct frame *f = p->frame;
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      if (f != p->frame)
+        {
+          lock_release (&f->lock);
+          ASSERT (p->frame == NULL);
+        }
+    }
+}
+
+/* Releases frame F for use by another page.  F must be locked
+   by the caller, and is unlocked on return. */
+void
+frame_free (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  f->page = NULL;
+  lock_release (&f->lock);
+}
+
+/* Unlocks frame F, allowing it to be evicted. */
+void
+frame_unlock (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
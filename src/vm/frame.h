@@ -0,0 +1,23 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+#include "threads/synch.h"
+
+/* A physical frame in the user pool. */
+struct frame
+  {
+    struct lock lock;           /* Prevents simultaneous access. */
+    void *base;                 /* Kernel virtual base address. */
+    struct page *page;          /* Page held, or null if free. */
+  };
+
+void frame_init (void);
+
+struct frame *frame_alloc_and_lock (struct page *);
+void frame_lock (struct page *);
+
+void frame_free (struct frame *);
+void frame_unlock (struct frame *);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,400 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Supplemental page table.
+
+   Each process has a hash table of the pages in its address
+   space, keyed by user virtual address.  A page is entered in
+   the table when the process is loaded, but no memory is
+   allocated for it until the process first touches it: the
+   resulting page fault calls page_in(), which allocates a frame,
+   fills it from the executable file or with zeros, and maps it
+   into the process's page directory.
+
+   When memory runs short, the frame table evicts pages with
+   page_unmap().  A page that has not been modified since it was
+   loaded is simply dropped and loaded again on its next fault.
+   A modified page has no copy anywhere else, so it is written to
+   swap, and read back from there on its next fault.
+
+   Pages of memory-mapped files differ only in that their file is
+   their home: a modified one is written back to the file instead
+   of to swap, on eviction and when it is unmapped. */
+
+/* Number of pages below the faulting one brought in at once when
+   the stack grows one page at a time. */
+#define STACK_GROW_PAGES 4
+
+/* Maximum size of a user stack, in bytes. */
+size_t page_stack_limit = 8 * 1024 * 1024;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_free;
+
+/* Creates an empty page table for the current process.  Returns
+   true if successful, false if memory is exhausted. */
+bool
+page_table_create (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->pages == NULL);
+  cur->pages = malloc (sizeof *cur->pages);
+  if (cur->pages == NULL)
+    return false;
+  if (!hash_init (cur->pages, page_hash, page_less, NULL))
+    {
+      free (cur->pages);
+      cur->pages = NULL;
+      return false;
+    }
+  return true;
+}
+
+/* Destroys the current process's page table and frees the
+   frames that hold its pages.  Must be called before the
+   process's page directory is destroyed. */
+void
+page_table_destroy (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->pages == NULL)
+    return;
+  hash_destroy (cur->pages, page_free);
+  free (cur->pages);
+  cur->pages = NULL;
+}
+
+/* Returns the page containing user virtual address ADDR in the
+   current process's page table, or a null pointer if there is
+   none. */
+static struct page *
+page_lookup (const void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct page key;
+  struct hash_elem *e;
+
+  if (cur->pages == NULL)
+    return NULL;
+  key.addr = pg_round_down (addr);
+  e = hash_find (cur->pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Adds a page at user virtual address VADDR, which must be page
+   aligned, to the current process's page table.  The page
+   starts out all zeros; the caller may set its FILE,
+   FILE_OFFSET, and READ_BYTES to load it from a file instead.
+   Returns the new page, or a null pointer if VADDR is already
+   in the table or memory is exhausted. */
+struct page *
+page_allocate (void *vaddr, bool writable)
+{
+  struct thread *cur = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (vaddr) == 0);
+  ASSERT (is_user_vaddr (vaddr));
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->addr = vaddr;
+  p->writable = writable;
+  p->thread = cur;
+  p->frame = NULL;
+  p->swap_sector = SWAP_NONE;
+  p->file = NULL;
+  p->file_offset = 0;
+  p->read_bytes = 0;
+  p->mapped = false;
+  p->modified = false;
+
+  if (hash_insert (cur->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Allocates a frame for page P, which is not in memory, and
+   loads its contents.  Returns true if successful, with P's
+   frame locked, false on failure. */
+static bool
+do_page_in (struct page *p)
+{
+  p->frame = frame_alloc_and_lock (p);
+  if (p->frame == NULL)
+    return false;
+
+  if (p->swap_sector != SWAP_NONE)
+    {
+      swap_in (p);
+      return true;
+    }
+  else if (p->file != NULL)
+    {
+      /* The fault may have come from a system call that already
+         holds the file system lock. */
+      bool held = lock_held_by_current_thread (&filesys_lock);
+      off_t read;
+
+      if (!held)
+        lock_acquire (&filesys_lock);
+      read = file_read_at (p->file, p->frame->base, p->read_bytes,
+                           p->file_offset);
+      if (!held)
+        lock_release (&filesys_lock);
+      if (read != p->read_bytes)
+        {
+          frame_free (p->frame);
+          p->frame = NULL;
+          return false;
+        }
+    }
+  memset ((uint8_t *) p->frame->base + p->read_bytes, 0,
+          PGSIZE - p->read_bytes);
+  return true;
+}
+
+/* Brings page P into memory, if it is not already there, and
+   maps it into its process's page directory.  Returns true if
+   successful, with P's frame locked, false on failure. */
+static bool
+lock_and_map (struct page *p)
+{
+  frame_lock (p);
+  if (p->frame == NULL && !do_page_in (p))
+    return false;
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (pagedir_get_page (p->thread->pagedir, p->addr) == NULL
+      && !pagedir_set_page (p->thread->pagedir, p->addr, p->frame->base,
+                            p->writable))
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+  return true;
+}
+
+/* Removes the page at user virtual address VADDR, which must be
+   page aligned, from the current process's page table, writing
+   it back to its file first if it is a modified memory-mapped
+   page. */
+void
+page_deallocate (void *vaddr)
+{
+  struct page *p = page_lookup (vaddr);
+
+  ASSERT (p != NULL);
+  hash_delete (thread_current ()->pages, &p->hash_elem);
+  page_free (&p->hash_elem, NULL);
+}
+
+/* Brings the page containing FAULT_ADDR into memory and maps it
+   into the current process's page directory.  Returns true if
+   successful, false if FAULT_ADDR is not part of the process's
+   address space or memory is exhausted. */
+bool
+page_in (void *fault_addr)
+{
+  struct page *p = page_lookup (fault_addr);
+
+  if (p == NULL || !lock_and_map (p))
+    return false;
+  frame_unlock (p->frame);
+  return true;
+}
+
+/* Grows the current process's stack to include the page
+   containing FAULT_ADDR, if that is a plausible stack access
+   given user stack pointer ESP, and brings the page in.  Returns
+   true if successful, false if FAULT_ADDR is not a stack access
+   or memory is exhausted.
+
+   The PUSHA instruction faults 32 bytes below ESP, so accesses
+   that far below ESP count as stack accesses.  If the page just
+   above is already part of the stack, the stack is evidently
+   growing a page at a time, so up to STACK_GROW_PAGES more pages
+   below are brought in as well, to save the faults on them. */
+bool
+page_grow_stack (void *fault_addr, void *esp)
+{
+  uint8_t *upage = pg_round_down (fault_addr);
+  bool sequential;
+  int i;
+
+  if (thread_current ()->pages == NULL
+      || (uint8_t *) fault_addr + 32 < (uint8_t *) esp
+      || (size_t) ((uint8_t *) PHYS_BASE - upage) > page_stack_limit
+      || page_lookup (upage) != NULL)
+    return false;
+
+  sequential = page_lookup (upage + PGSIZE) != NULL;
+  if (page_allocate (upage, true) == NULL || !page_in (upage))
+    return false;
+
+  for (i = 0; sequential && i < STACK_GROW_PAGES; i++)
+    {
+      upage -= PGSIZE;
+      if ((size_t) ((uint8_t *) PHYS_BASE - upage) > page_stack_limit
+          || page_lookup (upage) != NULL
+          || page_allocate (upage, true) == NULL)
+        break;
+      page_in (upage);
+    }
+  return true;
+}
+
+/* Brings the page containing ADDR into memory, maps it, and
+   locks it there, so that the kernel may access it through
+   either its user or its kernel address until page_unlock().
+   Returns true if successful, false if ADDR is not part of the
+   current process's address space or memory is exhausted. */
+bool
+page_lock (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+  return p != NULL && lock_and_map (p);
+}
+
+/* Unlocks the page containing ADDR, locked with page_lock(). */
+void
+page_unlock (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+
+  ASSERT (p != NULL && p->frame != NULL);
+  frame_unlock (p->frame);
+}
+
+/* Unmaps page P, whose frame the caller must have locked, as
+   the first step in evicting it.  Returns true if P's contents
+   must be written to swap, or to its file if it is memory-mapped,
+   before the frame can be reused.
+   Otherwise, P has been dropped and no longer has a frame, but
+   the frame stays locked. */
+bool
+page_unmap (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Unmap the page first, so that the process cannot modify it
+     between our check of the dirty bit and the eviction.  A
+     later access faults and waits for the frame lock. */
+  pagedir_clear_page (pd, p->addr);
+  if (pagedir_is_dirty (pd, p->addr))
+    p->modified = true;
+
+  if (p->modified)
+    return true;
+  p->frame = NULL;
+  return false;
+}
+
+/* Maps page P, which page_unmap() could not drop, back into its
+   process's page directory after it could not be written to
+   swap. */
+void
+page_remap (struct page *p)
+{
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (!pagedir_set_page (p->thread->pagedir, p->addr, p->frame->base,
+                         p->writable))
+    PANIC ("cannot remap page %p", p->addr);
+}
+
+/* Writes memory-mapped page P, whose frame the caller must have
+   locked, back to its file. */
+void
+page_write_back (struct page *p)
+{
+  bool held = lock_held_by_current_thread (&filesys_lock);
+
+  ASSERT (p->mapped);
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (!held)
+    lock_acquire (&filesys_lock);
+  file_write_at (p->file, p->frame->base, p->read_bytes, p->file_offset);
+  if (!held)
+    lock_release (&filesys_lock);
+  p->modified = false;
+}
+
+/* Returns true if page P, which must be in memory with its
+   frame locked, has been accessed since the last call, and
+   clears its accessed bit. */
+bool
+page_accessed_recently (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  bool accessed;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  accessed = pagedir_is_accessed (pd, p->addr);
+  if (accessed)
+    pagedir_set_accessed (pd, p->addr, false);
+  return accessed;
+}
+
+/* Frees page E, along with its frame or swap slot, if it has
+   one. */
+static void
+page_free (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      uint32_t *pd = p->thread->pagedir;
+
+      pagedir_clear_page (pd, p->addr);
+      if (p->mapped && (p->modified || pagedir_is_dirty (pd, p->addr)))
+        page_write_back (p);
+      frame_free (p->frame);
+    }
+  swap_discard (p);
+  free (p);
+}
+/* Returns a hash value for the page that E refers to. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->addr, sizeof p->addr);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->addr < b->addr;
+}
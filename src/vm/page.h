@@ -0,0 +1,58 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* A page of a process's virtual address space.  Records where
+   the page's contents are while it is not in memory. */
+struct page
+  {
+    struct hash_elem hash_elem; /* Element in thread's `pages'. */
+    void *addr;                 /* User virtual address. */
+    bool writable;              /* Writable by the process? */
+    struct thread *thread;      /* Owning process. */
+
+    /* Set only by the owning process, or by another thread that
+       holds FRAME's lock. */
+    struct frame *frame;        /* Frame holding the page, or null. */
+    block_sector_t swap_sector; /* First sector in swap, or SWAP_NONE. */
+
+    /* Contents until the page is first modified: READ_BYTES
+       bytes from FILE starting at FILE_OFFSET, followed by zeros.
+       FILE is null for a page that starts out all zeros. */
+    struct file *file;          /* File, or null. */
+    off_t file_offset;          /* Offset in FILE. */
+    off_t read_bytes;           /* Bytes to read from FILE. */
+
+    /* A memory-mapped page is written back to FILE, instead of to
+       swap, when it is evicted or unmapped after being modified. */
+    bool mapped;                /* Memory-mapped file page? */
+
+    /* Once set, the page's contents differ from FILE, so it must
+       be written back to FILE if mapped, or to swap otherwise,
+       before its frame can be reused. */
+    bool modified;              /* Changed since it was loaded? */
+  };
+
+/* Maximum size of a user stack, in bytes.
+   Controlled by kernel command-line option "-stack". */
+extern size_t page_stack_limit;
+
+bool page_table_create (void);
+void page_table_destroy (void);
+struct page *page_allocate (void *vaddr, bool writable);
+void page_deallocate (void *vaddr);
+bool page_in (void *fault_addr);
+bool page_grow_stack (void *fault_addr, void *esp);
+bool page_lock (const void *addr);
+void page_unlock (const void *addr);
+bool page_unmap (struct page *);
+void page_remap (struct page *);
+void page_write_back (struct page *);
+bool page_accessed_recently (struct page *);
+
+#endif /* vm/page.h */
@@ -0,0 +1,123 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap space.
+
+   The swap device is divided into page-sized slots, tracked by a
+   bitmap.  A page written to swap keeps its slot until it is read
+   back in or its process exits.
+
+   The frame table evicts several pages at a time, and swap_out()
+   puts them in adjacent slots, so that they go to the device in a
+   single multi-sector write. */
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Used swap slots. */
+static struct bitmap *swap_map;
+
+/* Protects swap_map. */
+static struct lock swap_lock;
+
+/* Sets up swap on the BLOCK_SWAP device, if there is one. */
+void
+swap_init (void)
+{
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    {
+      printf ("no swap device--swap disabled\n");
+      swap_map = bitmap_create (0);
+    }
+  else
+    swap_map = bitmap_create (block_size (swap_device) / PAGE_SECTORS);
+  if (swap_map == NULL)
+    PANIC ("couldn't create swap bitmap");
+  lock_init (&swap_lock);
+}
+
+/* Reads page P, which must be in swap, into its frame, which
+   the caller must have locked, and releases its swap slot. */
+void
+swap_in (struct page *p)
+{
+  struct block_iovec iov;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+  ASSERT (p->swap_sector != SWAP_NONE);
+
+  iov.base = p->frame->base;
+  iov.size = PGSIZE;
+  block_read_multi (swap_device, p->swap_sector, PAGE_SECTORS, &iov, 1);
+  swap_discard (p);
+}
+
+/* Writes the CNT pages in PAGES, each in a frame that the caller
+   has locked, to swap, in adjacent slots if possible.  If there
+   is no run of CNT free slots, writes fewer pages instead.
+   Returns the number of pages written, which are the first ones
+   in PAGES.  Each page written records its swap slot but keeps
+   its frame, which the caller must release, and clear the page's
+   FRAME, while it still holds the frame's lock. */
+size_t
+swap_out (struct page **pages, size_t cnt)
+{
+  struct block_iovec iov[SWAP_CLUSTER];
+  size_t slot, i;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+  /* Find free slots, settling for a shorter run if need be. */
+  lock_acquire (&swap_lock);
+  for (;;)
+    {
+      slot = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+      if (slot != BITMAP_ERROR || cnt == 1)
+        break;
+      cnt /= 2;
+    }
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return 0;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct page *p = pages[i];
+
+      ASSERT (p->frame != NULL);
+      ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+      iov[i].base = p->frame->base;
+      iov[i].size = PGSIZE;
+    }
+  block_write_multi (swap_device, slot * PAGE_SECTORS, cnt * PAGE_SECTORS,
+                     iov, cnt);
+
+  for (i = 0; i < cnt; i++)
+    pages[i]->swap_sector = (slot + i) * PAGE_SECTORS;
+  return cnt;
+}
+
+/* Releases page P's swap slot, if it has one. */
+void
+swap_discard (struct page *p)
+{
+  if (p->swap_sector == SWAP_NONE)
+    return;
+
+  lock_acquire (&swap_lock);
+  bitmap_reset (swap_map, p->swap_sector / PAGE_SECTORS);
+  lock_release (&swap_lock);
+  p->swap_sector = SWAP_NONE;
+}
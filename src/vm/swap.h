@@ -0,0 +1,20 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Swap sector of a page that is not in swap. */
+#define SWAP_NONE ((block_sector_t) -1)
+
+/* Maximum number of pages written to swap in one request. */
+#define SWAP_CLUSTER 8
+
+struct page;
+
+void swap_init (void);
+void swap_in (struct page *);
+size_t swap_out (struct page **, size_t cnt);
+void swap_discard (struct page *);
+
+#endif /* vm/swap.h */